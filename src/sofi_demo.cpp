@@ -16,6 +16,36 @@
  * <li>The results of operations can be examined by any SQLite client program.
  * </ol>
  *
+ * Instead of a single batch of operations executed by \c run, operations can
+ * be executed by a long-running process <tt>sofi_demo serve
+ * <em>file.db</em></tt>, which waits for new operations inserted into the
+ * database.
+ *
+ * Values no longer referenced by any entity can be removed from the database
+ * by <tt>sofi_demo gc <em>file.db</em></tt>.
+ *
+ * Entities can be partitioned into several database files (shards) by
+ * <tt>sofi_demo -s <em>shards</em> reshard <em>file.db</em></tt>, so that
+ * operations on entities in different shards do not serialize on a single
+ * database lock. Requests and results stay in <em>file.db</em>.
+ *
+ * Alternatively, commands \c run and \c serve with <tt>-b log</tt> keep
+ * entities in memory and persist them in an append-only log with periodic
+ * snapshots (demo::log_agent), until they are stored back to the database by
+ * <tt>sofi_demo checkpoint <em>file.db</em></tt>.
+ *
+ * Entities can be compiled to a read-only memory-mapped image
+ * (demo::policy_image) by <tt>sofi_demo compile <em>file.db</em></tt>. Then
+ * <tt>sofi_demo check <em>file.db</em></tt> evaluates verdicts of requested
+ * operations using entities from the image, without executing the operations.
+ *
+ * Each command accepts an optional <tt>-p <em>preset</em></tt> selecting
+ * named connection options (sqlite::connection::options::preset()), for
+ * example, \c bulk_load for importing large data or \c oltp for low-latency
+ * execution of operations. Commands \c run and \c serve accept <tt>-j
+ * <em>jobs</em></tt>, which prepares operations on disjoint entities in
+ * parallel threads.
+ *
  * The database schema is currently documented only by the initialization SQL
  * statements and comments in cmd_init().
  *
@@ -27,14 +57,42 @@
 #include "soficpp/soficpp.hpp"
 #include "sqlite_cpp.hpp"
 
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <condition_variable>
 #include <cstddef>
 #include <deque>
+#include <filesystem>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <ranges>
+#include <span>
 #include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <variant>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 //! SOFI classes used by program \c sofi_demo
 namespace demo {
@@ -82,8 +140,9 @@ class entity;
 
 //! The integrity type
 /*! An integrity is a set of strings. A set of all possible strings is
- * represented by soficpp::integrity_set::universe. */
-using integrity = soficpp::integrity_set<std::string>;
+ * represented by soficpp::integrity_set::universe. Integrities carry a 64-bit
+ * signature, because most dominance tests in ACLs fail. */
+using integrity = soficpp::integrity_set<std::string, 64>;
 
 //! The verdict type
 class verdict: public soficpp::simple_verdict {
@@ -94,17 +153,23 @@ public:
     bool error = false;
     //! Indication of an operation destroying its object
     bool destroy = false;
+    //! Indication of an operation creating a copy of its object, named by the operation argument
+    bool clone = false;
 };
 
 //! A base class for defining operations
+/*! All operations are registered in a single immutable registry, created on
+ * first use. An operation is found by its op_id by indexing an array and by
+ * its name by a perfect hash table. */
 class operation: public soficpp::operation_base<op_id> {
 public:
-    //! The type of map of operations
-    using ops_map_t = std::map<op_id, std::unique_ptr<operation>>;
+    //! The number of operations, \ref op_id::destroy must be the last value of op_id
+    static constexpr size_t count = static_cast<size_t>(op_id::destroy) + 1;
+    //! The type of the registry of operations, indexed by op_id
+    using ops_map_t = std::array<std::unique_ptr<operation>, count>;
+    //! Gets the operation name.
+    /*! \return the name, set when the operation is registered */
     [[nodiscard]] std::string_view name() const override {
-        std::lock_guard lck(_mtx);
-        if (_name.empty())
-            _name = soficpp::enum2str(id());
         return _name;
     }
     //! Executes the operation and stores the result in the verdict object.
@@ -112,20 +177,18 @@ public:
      * \param[in, out] object the object of the operation
      * \param[in] arg an argument of the operation
      * \param[out] result the result object, the operation result is stored in
-     * verdict::error. */
+     * verdict::error, verdict::destroy, and verdict::clone. */
     void execute(entity& subject, entity& object, const::std::string& arg, verdict& result) const {
         _destroy_object = false;
+        _clone_object = false;
         if (!do_exec(subject, object, arg))
             result.error = true;
-        else
+        else {
             if (_destroy_object)
                 result.destroy = true;
-    }
-    //! Stores a database connection that can be used by do_exec() called in the current thread.
-    /*! \param[in] db a database connection, or \c nullptr to unregisted any
-     * stored database connection */
-    static void attach_db(sqlite::connection* db = nullptr) {
-        _db = db;
+            if (_clone_object)
+                result.clone = true;
+        }
     }
     //! Gets the map of all operations.
     /*! \return the map containing all known operations */
@@ -136,6 +199,11 @@ public:
      * \throw std::invalid_argument if there is no operation object for a given
      * \a id */
     static const operation& get(op_id id);
+    //! Finds an operation by its name.
+    /*! \param[in] name the name of an operation
+     * \return the operation object, \c nullptr if there is no operation
+     * called \a name */
+    static const operation* find(std::string_view name) noexcept;
 protected:
     //! Implementation of the operation.
     /*! The default implementation does nothing and returns success.
@@ -152,15 +220,21 @@ protected:
     static void destroy_object() {
         _destroy_object = true;
     }
-    static thread_local sqlite::connection* _db; //!< A database connection that can be used by do_exec()
+    //! Can be called by do_exec() to request copying the object of the current operation in the current thread.
+    /*! The copy is named by the argument of the operation. It is stored
+     * together with the object, after the operation completes. */
+    static void clone_object() {
+        _clone_object = true;
+    }
 private:
-    mutable std::mutex _mtx{}; //!< A mutex for _name
-    mutable std::string _name{}; //!< Cached result of name()
+    class registry;
+    std::string_view _name{}; //!< The name of the operation, set by registry
     static thread_local bool _destroy_object; //!< Used by execute() and destroy_object()
+    static thread_local bool _clone_object; //!< Used by execute() and clone_object()
 };
 
-thread_local sqlite::connection* operation::_db = nullptr;
 thread_local bool operation::_destroy_object = false;
+thread_local bool operation::_clone_object = false;
 
 //! The access controller (ACL) type
 using acl = soficpp::ops_acl<integrity, operation, verdict>;
@@ -226,7 +300,7 @@ integrity integrity_fun::operator()(const integrity& i, const integrity& limit,
 {
     integrity result{};
     for (auto&& v: *this)
-        if (v.first <= i) {
+        if (soficpp::leq(v.first, i)) {
             if (v.second)
                 result = result + *v.second;
             else
@@ -235,13 +309,151 @@ integrity integrity_fun::operator()(const integrity& i, const integrity& limit,
     return result * limit;
 }
 
+//! Data of an entity
+/*! It is a rope: a sequence of immutable reference-counted chunks of
+ * characters. Copying a payload copies only pointers to its chunks, and
+ * appending adds pointers to chunks of the appended payload. Therefore, data
+ * are not copied by operations that read, write, or append data of another
+ * entity, nor by copying entities. Appended chunks smaller than \ref
+ * small_chunk are merged, and a payload with more than \ref max_chunks chunks
+ * is flattened into a single chunk, so that the number of chunks stays
+ * bounded. */
+class payload {
+public:
+    //! A chunk of characters
+    using chunk_t = std::shared_ptr<const std::string>;
+    //! The maximum number of chunks before flattening
+    static constexpr size_t max_chunks = 16;
+    //! The size of chunks merged when appending
+    static constexpr size_t small_chunk = 4096;
+    //! Creates an empty payload.
+    payload() = default;
+    //! Creates a payload from a string.
+    /*! \param[in] s the contents */
+    payload(std::string s) { // NOLINT(hicpp-explicit-conversions)
+        if (!s.empty())
+            _chunks.push_back(std::make_shared<const std::string>(std::move(s)));
+        _size = _chunks.empty() ? 0 : _chunks.front()->size();
+    }
+    //! Creates a payload from a string.
+    /*! \param[in] s the contents */
+    payload(std::string_view s): payload(std::string{s}) {} // NOLINT(hicpp-explicit-conversions)
+    //! Creates a payload from a string.
+    /*! \param[in] s the contents */
+    payload(const char* s): payload(std::string{s}) {} // NOLINT(hicpp-explicit-conversions)
+    //! Gets the size.
+    /*! \return the number of characters */
+    [[nodiscard]] size_t size() const noexcept {
+        return _size;
+    }
+    //! Tests if the payload is empty.
+    /*! \return whether size() is zero */
+    [[nodiscard]] bool empty() const noexcept {
+        return _size == 0;
+    }
+    //! Gets the chunks.
+    /*! It can be used to process data without flattening.
+     * \return the chunks, none of them empty */
+    [[nodiscard]] std::span<const chunk_t> chunks() const noexcept {
+        return _chunks;
+    }
+    //! Gets the contents as a single string.
+    /*! If there are more than one chunk, they are flattened into a single
+     * chunk, which is then kept by this payload. Other payloads sharing the
+     * chunks are not changed.
+     * \return the contents, valid until this payload is changed or destroyed */
+    [[nodiscard]] const std::string& str() const;
+    //! Appends another payload.
+    /*! \param[in] p the appended payload
+     * \return \c *this */
+    payload& operator+=(const payload& p);
+    //! Compares contents of payloads.
+    /*! \param[in] p another payload
+     * \return whether both payloads contain the same characters */
+    bool operator==(const payload& p) const;
+private:
+    //! Appends a chunk, merging small chunks.
+    /*! \param[in] c a nonempty chunk */
+    void append(const chunk_t& c);
+    //! Replaces all chunks by a single chunk.
+    void flatten() const;
+    //! Chunks of data, modified by flatten() without changing contents
+    mutable std::vector<chunk_t> _chunks{};
+    //! The total size of all chunks
+    size_t _size = 0;
+    //! Writes the contents of a payload.
+    /*! \param[in] os an output stream
+     * \param[in] p a payload
+     * \return \a os */
+    friend std::ostream& operator<<(std::ostream& os, const payload& p) {
+        for (auto&& c: p._chunks)
+            os << *c;
+        return os;
+    }
+};
+
+const std::string& payload::str() const
+{
+    static const std::string empty{};
+    if (_chunks.empty())
+        return empty;
+    flatten();
+    return *_chunks.front();
+}
+
+payload& payload::operator+=(const payload& p)
+{
+    if (this == &p) {
+        payload copy{p};
+        return *this += copy;
+    }
+    for (auto&& c: p._chunks)
+        append(c);
+    if (_chunks.size() > max_chunks)
+        flatten();
+    return *this;
+}
+
+bool payload::operator==(const payload& p) const
+{
+    if (_size != p._size)
+        return false;
+    if (_chunks.size() == 1 && p._chunks.size() == 1 && _chunks.front() == p._chunks.front())
+        return true;
+    return str() == p.str();
+}
+
+void payload::append(const chunk_t& c)
+{
+    if (!_chunks.empty() && _chunks.back()->size() + c->size() <= small_chunk) {
+        auto merged = std::make_shared<std::string>();
+        merged->reserve(_chunks.back()->size() + c->size());
+        *merged += *_chunks.back();
+        *merged += *c;
+        _chunks.back() = std::move(merged);
+    } else
+        _chunks.push_back(c);
+    _size += c->size();
+}
+
+void payload::flatten() const
+{
+    if (_chunks.size() <= 1)
+        return;
+    auto flat = std::make_shared<std::string>();
+    flat->reserve(_size);
+    for (auto&& c: _chunks)
+        *flat += *c;
+    _chunks.assign(1, std::move(flat));
+}
+
 //! The entity type
 class entity: public soficpp::basic_entity<integrity, min_integrity, operation, verdict, acl, integrity_fun> {
 public:
     //! The name of the entity, used as the primary key in the database
     std::string name{};
     //! Data of the entity, usable in operations
-    std::string data{};
+    payload data{};
     //! The name of the integrity testing function
     std::string test_fun_name{};
     //! The name of the integrity providing function
@@ -250,7 +462,610 @@ public:
     std::string recv_fun_name{};
 };
 
+//! An allocator of IDs from a persistent sequence
+/*! It allocates IDs from a named sequence stored in database table \c
+ * sequence. It reserves blocks of IDs in the database, so that most IDs are
+ * allocated without accessing the database. IDs of a reserved block that are
+ * not used before the allocator is destroyed are lost.
+ *
+ * A block is reserved in the current transaction. If the transaction is rolled
+ * back, reset() must be called, otherwise the allocator would later return IDs
+ * that are not reserved in the database. */
+class id_allocator {
+public:
+    //! The default number of IDs reserved at once
+    static constexpr int64_t default_block = 64;
+    //! Creates the allocator.
+    /*! No IDs are reserved until the first call of operator()().
+     * \param[in] db a database connection
+     * \param[in] name the name of the sequence in table \c sequence
+     * \param[in] block the number of IDs reserved at once */
+    id_allocator(sqlite::connection& db, std::string name, int64_t block = default_block);
+    //! Allocates an ID.
+    /*! \return the next available ID from the sequence
+     * \throw std::runtime_error if the sequence does not exist in the
+     * database */
+    int64_t operator()();
+    //! Discards all IDs reserved by this allocator.
+    /*! It should be called after the transaction that reserved the current
+     * block is rolled back. */
+    void reset() noexcept {
+        _next = _end;
+    }
+private:
+    std::string _name; //!< The name of the sequence
+    int64_t _block; //!< The number of IDs reserved at once
+    int64_t _next = 0; //!< The next available ID in the reserved block
+    int64_t _end = 0; //!< The first ID after the reserved block
+    sqlite::query_lease _reserve; //!< SQL query for reserving a block of IDs
+};
+
+id_allocator::id_allocator(sqlite::connection& db, std::string name, int64_t block):
+    _name(std::move(name)), _block(block),
+    _reserve(db.cached(R"(update sequence set next = next + $1 where name = $2 returning next)"))
+{
+    assert(_block > 0);
+}
+
+int64_t id_allocator::operator()()
+{
+    if (_next == _end) {
+        if (_reserve->start().bind_all(_block, _name).next_row() != sqlite::query::status::row)
+            throw std::runtime_error("Unknown sequence \"" + _name + "\"");
+        assert(_reserve->column_count() == 1);
+        _end = _reserve->get<int64_t>(0);
+        _next = _end - _block;
+        _reserve->start(); // no query may be running during transaction commit
+    }
+    return _next++;
+}
+
+//! Appends a string quoted as a JSON string value.
+/*! \param[in, out] out the result is appended to this string
+ * \param[in] s a string to be quoted */
+void json_quote(std::string& out, std::string_view s)
+{
+    out += '"';
+    for (char c: s)
+        switch (c) {
+        case '"':
+            out += R"(\")";
+            break;
+        case '\\':
+            out += R"(\\)";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                constexpr std::string_view hex = "0123456789abcdef";
+                out += R"(\u00)";
+                out += hex[static_cast<unsigned char>(c) >> 4];
+                out += hex[static_cast<unsigned char>(c) & 0xf];
+            } else
+                out += c;
+            break;
+        }
+    out += '"';
+}
+
+//! Converts an integrity to JSON.
+/*! \param[in] i an integrity
+ * \return \a i in the format used by database view \c integrity_json: either
+ * the string \c "universe", or a JSON array containing string elements in
+ * ascending order */
+std::string integrity2json(const integrity& i)
+{
+    if (std::holds_alternative<integrity::universe>(i.value()))
+        return R"("universe")";
+    std::string result{'['};
+    for (bool first = true; auto&& e: std::get<integrity::set_t>(i.value())) {
+        if (first)
+            first = false;
+        else
+            result += ',';
+        json_quote(result, e);
+    }
+    result += ']';
+    return result;
+}
+
+//! A single-pass parser of integrities in JSON
+/*! It parses an integrity in the format produced by integrity2json() and a
+ * minimum integrity as a JSON array of such integrities, without any database
+ * access. Elements of an integrity need not be sorted and may be repeated.
+ * Whitespace between tokens and all JSON escape sequences in strings are
+ * accepted. A string without escape sequences is copied directly from the
+ * input. */
+class integrity_json_parser {
+public:
+    //! Parses an integrity.
+    /*! \param[in] s an integrity in JSON
+     * \return the integrity, \c std::nullopt if \a s is invalid */
+    static std::optional<integrity> parse_integrity(std::string_view s) {
+        integrity_json_parser p{s};
+        integrity i{};
+        if (!p.integrity_value(i) || !p.at_end())
+            return std::nullopt;
+        return i;
+    }
+    //! Parses a minimum integrity.
+    /*! \param[in] s a JSON array of integrities
+     * \return the minimum integrity, \c std::nullopt if \a s is invalid */
+    static std::optional<min_integrity> parse_min_integrity(std::string_view s) {
+        integrity_json_parser p{s};
+        min_integrity::container_t ic{};
+        if (!p.skip('['))
+            return std::nullopt;
+        if (!p.skip(']')) {
+            do {
+                if (!p.integrity_value(ic.emplace_back()))
+                    return std::nullopt;
+            } while (p.skip(','));
+            if (!p.skip(']'))
+                return std::nullopt;
+        }
+        if (!p.at_end())
+            return std::nullopt;
+        return min_integrity{std::move(ic)};
+    }
+private:
+    //! Creates the parser.
+    /*! \param[in] s the parsed input */
+    explicit integrity_json_parser(std::string_view s): _s(s) {}
+    //! Skips whitespace.
+    void ws() {
+        while (_pos < _s.size() && (_s[_pos] == ' ' || _s[_pos] == '\t' || _s[_pos] == '\n' || _s[_pos] == '\r'))
+            ++_pos;
+    }
+    //! Skips whitespace and a character, if present.
+    /*! \param[in] c the expected character
+     * \return whether \a c has been skipped */
+    bool skip(char c) {
+        ws();
+        if (_pos < _s.size() && _s[_pos] == c) {
+            ++_pos;
+            return true;
+        }
+        return false;
+    }
+    //! Skips whitespace and checks the end of input.
+    /*! \return whether the whole input has been parsed */
+    bool at_end() {
+        ws();
+        return _pos == _s.size();
+    }
+    //! Parses an integrity value.
+    /*! \param[out] i the parsed integrity
+     * \return whether successful */
+    bool integrity_value(integrity& i) {
+        ws();
+        if (_pos < _s.size() && _s[_pos] == '"') {
+            std::string v{};
+            if (!string_value(v) || v != "universe")
+                return false;
+            i = integrity{integrity::universe{}};
+            return true;
+        }
+        integrity::set_t elems{};
+        if (!skip('['))
+            return false;
+        if (!skip(']')) {
+            do {
+                std::string v{};
+                if (!string_value(v))
+                    return false;
+                // Exported integrities are sorted, hence the hint usually makes the insertion constant time
+                elems.emplace_hint(elems.end(), std::move(v));
+            } while (skip(','));
+            if (!skip(']'))
+                return false;
+        }
+        i = integrity{std::move(elems)};
+        return true;
+    }
+    //! Parses a string value.
+    /*! \param[out] v the parsed string
+     * \return whether successful */
+    bool string_value(std::string& v) {
+        if (!skip('"'))
+            return false;
+        // Fast path for a string without escape sequences
+        v.clear();
+        if (!raw_chars(v))
+            return false;
+        while (_s[_pos] != '"') {
+            if (++_pos == _s.size())
+                return false;
+            switch (char c = _s[_pos++]) {
+            case '"':
+            case '\\':
+            case '/':
+                v += c;
+                break;
+            case 'b':
+                v += '\b';
+                break;
+            case 'f':
+                v += '\f';
+                break;
+            case 'n':
+                v += '\n';
+                break;
+            case 'r':
+                v += '\r';
+                break;
+            case 't':
+                v += '\t';
+                break;
+            case 'u':
+                if (!unicode_escape(v))
+                    return false;
+                break;
+            default:
+                return false;
+            }
+            if (!raw_chars(v))
+                return false;
+        }
+        ++_pos;
+        return true;
+    }
+    //! Copies characters of a string up to the closing quote or an escape sequence.
+    /*! \param[in, out] v the characters are appended
+     * \return whether successful, that is, the characters are terminated and
+     * do not contain control characters */
+    bool raw_chars(std::string& v) {
+        size_t end = _s.find_first_of("\"\\", _pos);
+        if (end == std::string_view::npos)
+            return false;
+        auto raw = _s.substr(_pos, end - _pos);
+        if (!std::ranges::none_of(raw, [](char c) { return static_cast<unsigned char>(c) < 0x20; }))
+            return false;
+        v.append(raw);
+        _pos = end;
+        return true;
+    }
+    //! Parses 4 hexadecimal digits.
+    /*! \param[out] u the parsed value
+     * \return whether successful */
+    bool hex4(uint32_t& u) {
+        if (_s.size() - _pos < 4)
+            return false;
+        auto [p, ec] = std::from_chars(_s.data() + _pos, _s.data() + _pos + 4, u, 16);
+        if (ec != std::errc{} || p != _s.data() + _pos + 4)
+            return false;
+        _pos += 4;
+        return true;
+    }
+    //! Parses the rest of escape sequence <tt>\\u</tt>, including a surrogate pair.
+    /*! \param[in, out] v the character is appended in UTF-8
+     * \return whether successful */
+    bool unicode_escape(std::string& v) {
+        uint32_t u = 0;
+        if (!hex4(u))
+            return false;
+        if (u >= 0xd800 && u < 0xdc00) {
+            uint32_t low = 0;
+            if (_s.substr(_pos, 2) != R"(\u)")
+                return false;
+            _pos += 2;
+            if (!hex4(low) || low < 0xdc00 || low >= 0xe000)
+                return false;
+            u = 0x10000 + ((u - 0xd800) << 10) + (low - 0xdc00);
+        } else if (u >= 0xdc00 && u < 0xe000)
+            return false;
+        if (u < 0x80)
+            v += char(u);
+        else if (u < 0x800) {
+            v += char(0xc0 | (u >> 6));
+            v += char(0x80 | (u & 0x3f));
+        } else if (u < 0x10000) {
+            v += char(0xe0 | (u >> 12));
+            v += char(0x80 | ((u >> 6) & 0x3f));
+            v += char(0x80 | (u & 0x3f));
+        } else {
+            v += char(0xf0 | (u >> 18));
+            v += char(0x80 | ((u >> 12) & 0x3f));
+            v += char(0x80 | ((u >> 6) & 0x3f));
+            v += char(0x80 | (u & 0x3f));
+        }
+        return true;
+    }
+    std::string_view _s; //!< The parsed input
+    size_t _pos = 0; //!< The current position in \ref _s
+};
+
+//! Conversion of the policy of an entity to and from a binary blob
+/*! The policy consists of the integrity, the minimum integrity, the ACL, and
+ * the integrity modification functions of an entity. It is stored in column
+ * \c policy of database table \c entity_policy, so that an entity can be
+ * imported and exported by a single row operation.
+ *
+ * The blob starts with a format version byte, followed by the parts of the
+ * policy. Numbers are stored as unsigned LEB128, strings as their lengths
+ * followed by the characters. Parts are stored as:
+ * \arg integrity -- 0 for the universe, otherwise the number of elements plus 1,
+ * followed by the elements in ascending order
+ * \arg minimum integrity -- the number of integrities, followed by the
+ * integrities
+ * \arg ACL -- the default inner ACL (stored as a minimum integrity), the number
+ * of operations, and pairs (operation name, inner ACL)
+ * \arg integrity function -- the comment, the number of pairs, and pairs
+ * (integrity, 0 or 1 followed by an integrity)
+ *
+ * A missing inner ACL is stored as an empty one, as in the normalized tables
+ * \c acl_id and \c acl. */
+class policy_blob {
+public:
+    //! The current format version
+    static constexpr unsigned char version = 1;
+    //! Encodes the policy of an entity.
+    /*! \param[in] e an entity
+     * \return the policy of \a e */
+    static sqlite::blob_t encode(const entity& e);
+    //! Decodes the policy of an entity.
+    /*! \param[in] b a policy created by encode()
+     * \param[in, out] e the policy is stored into this entity, other members
+     * are unchanged
+     * \throw std::invalid_argument if \a b is not a valid policy */
+    static void decode(std::span<const unsigned char> b, entity& e);
+private:
+    friend class log_agent;
+    //! Appends a number.
+    /*! \param[in, out] b a blob
+     * \param[in] v a value */
+    static void put(sqlite::blob_t& b, uint64_t v);
+    //! Appends a string.
+    /*! \param[in, out] b a blob
+     * \param[in] v a value */
+    static void put(sqlite::blob_t& b, std::string_view v);
+    //! Appends an integrity.
+    /*! \param[in, out] b a blob
+     * \param[in] v a value */
+    static void put(sqlite::blob_t& b, const integrity& v);
+    //! Appends a minimum integrity or an inner ACL.
+    /*! \param[in, out] b a blob
+     * \param[in] v a value */
+    static void put(sqlite::blob_t& b, const acl::acl_t& v);
+    //! Appends an integrity function.
+    /*! \param[in, out] b a blob
+     * \param[in] v a value */
+    static void put(sqlite::blob_t& b, const integrity_fun& v);
+    //! Reads parts of a policy from a blob
+    class reader {
+    public:
+        //! Creates the reader.
+        /*! \param[in] b a blob */
+        explicit reader(std::span<const unsigned char> b): b(b) {}
+        //! Reads a number.
+        /*! \return the value */
+        uint64_t num();
+        //! Reads a number used as a count of items.
+        /*! \return the value, checked against the remaining size of the blob */
+        size_t count();
+        //! Reads a string.
+        /*! \return the value, valid as long as the blob */
+        std::string_view str();
+        //! Reads an integrity.
+        /*! \return the value */
+        integrity get_integrity();
+        //! Reads a minimum integrity or an inner ACL.
+        /*! \return the value */
+        acl::acl_t get_acl();
+        //! Reads an integrity function.
+        /*! \return the value */
+        integrity_fun get_fun();
+        //! Checks that the whole blob has been read.
+        /*! \return whether there is no more data */
+        [[nodiscard]] bool end() const noexcept {
+            return b.empty();
+        }
+    private:
+        std::span<const unsigned char> b; //!< The data not read yet
+    };
+    //! Reports an invalid blob.
+    /*! \throw std::invalid_argument always */
+    [[noreturn]] static void invalid() {
+        throw std::invalid_argument("Invalid policy blob");
+    }
+};
+
+sqlite::blob_t policy_blob::encode(const entity& e)
+{
+    static const acl::acl_t null_acl{};
+    sqlite::blob_t b{};
+    b.push_back(version);
+    put(b, e.integrity());
+    put(b, e.min_integrity());
+    put(b, e.access_ctrl().default_op ? *e.access_ctrl().default_op : null_acl);
+    put(b, uint64_t(e.access_ctrl().size()));
+    for (auto&& o: e.access_ctrl()) {
+        put(b, soficpp::enum2sv(o.first));
+        put(b, o.second ? *o.second : null_acl);
+    }
+    put(b, e.test_fun());
+    put(b, e.prov_fun());
+    put(b, e.recv_fun());
+    return b;
+}
+
+void policy_blob::decode(std::span<const unsigned char> b, entity& e)
+{
+    if (b.empty() || b.front() != version)
+        invalid();
+    reader r{b.subspan(1)};
+    e.integrity() = r.get_integrity();
+    e.min_integrity() = r.get_acl();
+    acl ac{r.get_acl()};
+    for (size_t n = r.count(); n > 0; --n) {
+        auto o = operation::find(r.str());
+        if (!o)
+            invalid();
+        op_id op = o->id();
+        ac[op] = std::make_shared<acl::acl_t>(r.get_acl());
+    }
+    e.access_ctrl() = std::move(ac);
+    e.test_fun() = r.get_fun();
+    e.test_fun_name = e.test_fun().comment;
+    e.prov_fun() = r.get_fun();
+    e.prov_fun_name = e.prov_fun().comment;
+    e.recv_fun() = r.get_fun();
+    e.recv_fun_name = e.recv_fun().comment;
+    if (!r.end())
+        invalid();
+}
+
+void policy_blob::put(sqlite::blob_t& b, uint64_t v)
+{
+    for (; v >= 0x80; v >>= 7)
+        b.push_back(static_cast<unsigned char>(v | 0x80));
+    b.push_back(static_cast<unsigned char>(v));
+}
+
+void policy_blob::put(sqlite::blob_t& b, std::string_view v)
+{
+    put(b, uint64_t(v.size()));
+    b.insert(b.end(), v.begin(), v.end());
+}
+
+void policy_blob::put(sqlite::blob_t& b, const integrity& v)
+{
+    if (std::holds_alternative<integrity::universe>(v.value())) {
+        put(b, uint64_t(0));
+        return;
+    }
+    auto& elems = std::get<integrity::set_t>(v.value());
+    put(b, uint64_t(elems.size()) + 1);
+    for (auto&& e: elems)
+        put(b, std::string_view{e});
+}
+
+void policy_blob::put(sqlite::blob_t& b, const acl::acl_t& v)
+{
+    put(b, uint64_t(v.size()));
+    for (auto&& i: v)
+        put(b, i);
+}
+
+void policy_blob::put(sqlite::blob_t& b, const integrity_fun& v)
+{
+    put(b, std::string_view{v.comment});
+    put(b, uint64_t(v.size()));
+    for (auto&& [cmp, plus]: v) {
+        put(b, cmp);
+        put(b, uint64_t(plus ? 1 : 0));
+        if (plus)
+            put(b, *plus);
+    }
+}
+
+uint64_t policy_blob::reader::num()
+{
+    uint64_t v = 0;
+    for (unsigned shift = 0; ; shift += 7) {
+        if (b.empty() || shift >= 64)
+            invalid();
+        unsigned char c = b.front();
+        b = b.subspan(1);
+        v |= uint64_t(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return v;
+    }
+}
+
+size_t policy_blob::reader::count()
+{
+    // Each item occupies at least one byte
+    uint64_t n = num();
+    if (n > b.size())
+        invalid();
+    return size_t(n);
+}
+
+std::string_view policy_blob::reader::str()
+{
+    size_t n = count();
+    std::string_view v{reinterpret_cast<const char*>(b.data()), n};
+    b = b.subspan(n);
+    return v;
+}
+
+integrity policy_blob::reader::get_integrity()
+{
+    uint64_t n = num();
+    if (n == 0)
+        return integrity{integrity::universe{}};
+    if (n - 1 > b.size())
+        invalid();
+    integrity::set_t elems{};
+    for (--n; n > 0; --n)
+        elems.emplace_hint(elems.end(), str());
+    return integrity{std::move(elems)};
+}
+
+acl::acl_t policy_blob::reader::get_acl()
+{
+    acl::acl_t v{};
+    size_t n = count();
+    v.reserve(n);
+    for (; n > 0; --n)
+        v.push_back(get_integrity());
+    return v;
+}
+
+integrity_fun policy_blob::reader::get_fun()
+{
+    integrity_fun v{};
+    v.comment = str();
+    size_t n = count();
+    v.reserve(n);
+    for (; n > 0; --n) {
+        integrity cmp = get_integrity();
+        std::optional<integrity> plus{};
+        switch (num()) {
+        case 0:
+            break;
+        case 1:
+            plus = get_integrity();
+            break;
+        default:
+            invalid();
+        }
+        v.emplace_back(std::move(cmp), std::move(plus));
+    }
+    return v;
+}
+
+//! Computes the 64-bit FNV-1a hash of a string.
+/*! The hash is stored in databases, therefore, it must not be changed.
+ * \param[in] s a string
+ * \return the hash of \a s */
+uint64_t fnv1a(std::string_view s)
+{
+    uint64_t h = 0xcbf29ce484222325U;
+    for (char c: s) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 0x100000001b3U;
+    }
+    return h;
+}
+
 //! The agent class that exports to and imports from the database
+/*! IDs of exported values are allocated by id_allocator objects from
+ * sequences \c integrity_id, \c acl_id, and \c int_fun_id.
+ *
+ * Exported integrities, ACLs, and integrity modification functions are
+ * content-addressed. Before a new ID is allocated for a value, its canonical
+ * form is looked up in tables \c integrity_hash, \c acl_hash, and \c
+ * int_fun_hash, and the ID of an equal value exported earlier is reused.
+ * Therefore, values with IDs present in these tables must not be modified.
+ * IDs no longer referenced by any entity can be deleted by <tt>sofi_demo
+ * gc</tt>.
+ *
+ * The policy of an exported entity is also stored as a policy_blob in table
+ * \c entity_policy. An entity with a row in \c entity_policy is imported
+ * from a single row. If the policy of an entity has not changed, only
+ * its data are exported. Other entities are imported from and exported to the
+ * normalized tables. */
 class agent {
 public:
     //! The entity type
@@ -259,25 +1074,80 @@ public:
     using message_t = std::string;
     //! Creates the agent.
     /*! \param[in] db a database connection used for export and import */
-    explicit agent(sqlite::connection& db);
+    explicit agent(sqlite::connection& db): agent(db, db) {}
+    //! Creates the agent with a separate connection for import.
+    /*! It is intended for use with a sqlite::pool, with \a db being the writer
+     * connection and \a reader a reader connection of the current thread.
+     * Entities are imported as committed to the database before the current
+     * transaction of \a db, if \a reader is different from \a db.
+     * \param[in] db a database connection used for export
+     * \param[in] reader a database connection used for import */
+    agent(sqlite::connection& db, sqlite::connection& reader);
     //! The export operation
     /*! It saves the entity to the database.
      * \param[in] e an entity
      * \param[out] m a message
-     * \return the result of export */
+     * \return the result of export
+     * \throw sqlite::busy_error if the database is busy, the transaction
+     * should be retried */
     soficpp::agent_result export_msg(const entity_t& e, message_t& m);
+    //! Copies an exported entity.
+    /*! It copies the row of entity \a from in table \c entity by a single
+     * statement, so that the copy references the same integrity, ACLs, and
+     * functions, and no parts of the entity are exported again. An existing
+     * entity \a to is replaced. It is equivalent to exporting a copy of the
+     * entity with name \a to.
+     * \param[in] from the name of the copied entity, it must have been
+     * already exported
+     * \param[in] to the name of the copy
+     * \return the result of copying, an error if entity \a from does not
+     * exist
+     * \throw sqlite::busy_error if the database is busy, the transaction
+     * should be retried */
+    soficpp::agent_result clone_msg(const message_t& from, const message_t& to);
     //! The import operation
     /*! It reads the entity from the database.
      * \param[in] m a message (an entity name)
      * \param[out] e an entity
      * \return the result of import */
     soficpp::agent_result import_msg(const message_t& m, entity_t& e);
+    //! The import operation for a batch of entities
+    /*! It reads all the entities from the database by a single query.
+     * \param[in] m messages (entity names)
+     * \param[out] e imported entities, in the same order as \a m
+     * \return the result of import, an error if any of the entities cannot be
+     * imported
+     * \throw sqlite::busy_error if the database is busy, the transaction
+     * should be retried */
+    soficpp::agent_result import_msgs(const std::vector<message_t>& m, std::vector<entity_t>& e);
+    //! Prepares the agent for retrying a rolled back transaction.
+    /*! It discards IDs reserved in the rolled back transaction. */
+    void reset() noexcept {
+        integrity_ids.reset();
+        acl_ids.reset();
+        int_fun_ids.reset();
+    }
 private:
     //! Thrown if something cannot be exported or imported
     struct export_import_error: public std::runtime_error {
         //! Creates the exception object.
         export_import_error(): runtime_error("export_import_error") {}
     };
+    //! Integrity IDs of inner ACLs, indexed by operation (\c std::nullopt for the default entry)
+    using acl_ids_t = std::vector<std::pair<std::optional<op_id>, std::vector<int64_t>>>;
+    //! Computes a hash of the canonical form of an exported value.
+    /*! \param[in] content the canonical form of a value
+     * \return the 64-bit FNV-1a hash of \a content */
+    static int64_t content_hash(std::string_view content);
+    //! Looks up an exported value in a content-addressed index.
+    /*! \param[in] q a query selecting \c id by \c hash (parameter 1) and \c
+     * content (parameter 2)
+     * \param[in] hash the hash of \a content
+     * \param[in] content the canonical form of the value
+     * \return the ID of the value if it has been already exported, \c
+     * std::nullopt otherwise
+     * \throw export_import_error if the query returns an invalid value */
+    static std::optional<int64_t> find_content(sqlite::query& q, int64_t hash, const std::string& content);
     //! Exports an integrity to the database
     /*! \param[in] i an integrity to be exported
      * \return id of the exported integrity
@@ -288,68 +1158,138 @@ private:
      * \return id of the exported ACL
      * \throw export_import_error if the ACL cannot be exported */
     int64_t export_msg_acl(const acl& a);
+    //! Exports an ACL containing only the default entry to the database
+    /*! It is used for exporting a minimum integrity.
+     * \param[in] a the ACL to be exported
+     * \return id of the exported ACL
+     * \throw export_import_error if the ACL cannot be exported */
+    int64_t export_msg_acl(const acl::acl_t& a);
+    //! Exports integrities of an inner ACL to the database
+    /*! \param[in] a an inner ACL
+     * \return sorted IDs of exported integrities, without duplicates
+     * \throw export_import_error if an integrity cannot be exported */
+    std::vector<int64_t> export_msg_acl_integrities(const acl::acl_t& a);
     //! Exports an ACL to the database
-    /*! \param[in] a the ACL to be exported
-     * \param[in] op the operation controlled by ACL \a a
-     * \param[in] id if it is not \c std::nullopt, then it is used as the id of the
-     * ACL in the database; if \c std::nullopt, then a new id will be generated
+    /*! \param[in] a the ACL to be exported, with all integrities already
+     * exported
      * \return id of the exported ACL
      * \throw export_import_error if the ACL cannot be exported */
-    int64_t export_msg_acl(const acl::acl_t& a, std::optional<op_id> op = {}, std::optional<int64_t> id = {});
+    int64_t export_msg_acl_ids(const acl_ids_t& a);
     //! Exports an integrity modification function to the database
     /*! \param[in] f a function to be exported
      * \return id of the exported function
      * \throw export_import_error if the function cannot be exported */
     int64_t export_msg_int_fun(const integrity_fun& f);
-    //! Imports an integrity from the database by id
-    /*! \param[in] id the id of the integrity
-     * \return the imported integrity
-     * \throw export_import_error if the integrity cannot be imported */
-    integrity import_msg_integrity(int64_t id);
-    //! Imports a minimum integrity from the database by id
-    /*! \param[in] id the id of the minimum integrity
-     * \return the imported integrity
-     * \throw export_import_error if the minimum integrity cannot be imported */
-    min_integrity import_msg_min_integrity(int64_t id);
-    //! Imports an ACL from the database by id
-    /*! \param[in] id the id of the ACL
-     * \return the imported ACL
-     * \throw export_import_error if the ACL cannot be imported */
-    acl import_msg_acl(int64_t id);
-    //! Imports an integrity modification function from the database by id
-    /*! \param[in] id the id of the function
-     * \return the imported function and its comment
-     * \throw export_import_error if the function cannot be imported */
-    std::pair<integrity_fun, std::string> import_msg_int_fun(int64_t id);
-    sqlite::query qexp_entity; //!< SQL query for exporting an entity
-    sqlite::query qexp_integrity_id; //!< SQL query for inserting into INTEGRITY_ID
-    sqlite::query qexp_integrity; //!< SQL query for inserting into INTEGRITY
-    sqlite::query qexp_acl_id; //!< SQL query for inserting into ACL_ID
-    sqlite::query qexp_acl; //!< SQL query for inserting into ACL
-    sqlite::query qexp_int_fun_id; //!< SQL query for inserting int INT_FUN_ID
-    sqlite::query qexp_int_fun; //!< SQL query for inserting int INT_FUN
-    sqlite::query qimp_entity; //!< SQL query for importing an entity
-    sqlite::query qimp_integrity; //!< SQL query for importing an integrity
-    sqlite::query qimp_min_integrity; //!< SQL query for importing a minimum integrity
-    sqlite::query qimp_acl; //!< SQL query for importing an ACL
-    sqlite::query qimp_int_fun; //!< SQL query for importing an integrity modification function
+    //! Rows of entities and their parts fetched by a single query, indexed by names and IDs
+    struct import_rows {
+        //! A row of table ENTITY
+        struct entity_row {
+            int64_t integrity = 0; //!< The integrity ID
+            int64_t min_integrity = 0; //!< The minimum integrity ID (an ACL ID)
+            int64_t acl = 0; //!< The ACL ID
+            int64_t test_fun = 0; //!< The testing function ID
+            int64_t prov_fun = 0; //!< The providing function ID
+            int64_t recv_fun = 0; //!< The receiving function ID
+            std::string data{}; //!< The entity data
+        };
+        //! Entities, indexed by names
+        std::map<std::string, entity_row, std::less<>> entities{};
+        //! Entries (operation, integrity ID) of ACLs, indexed by ACL IDs
+        std::map<int64_t, std::vector<std::pair<std::optional<op_id>, std::optional<int64_t>>>> acls{};
+        //! Comments and pairs (cmp, plus) of integrity functions, indexed by function IDs
+        std::map<int64_t, std::pair<std::string, std::vector<std::pair<int64_t, std::optional<int64_t>>>>> funs{};
+        //! Integrities, indexed by integrity IDs
+        std::map<int64_t, integrity> integrities{};
+    };
+    //! Reads entities and all their parts from the database
+    /*! \param[in] names a JSON array of entity names
+     * \return the rows read from the database
+     * \throw export_import_error if the database contains invalid values */
+    import_rows import_msg_rows(const std::string& names);
+    //! Assembles an entity from rows read from the database
+    /*! \param[in] rows rows returned by import_msg_rows()
+     * \param[in] m a message (an entity name)
+     * \param[out] e the imported entity
+     * \throw export_import_error if the entity cannot be imported */
+    static void import_msg_entity(const import_rows& rows, const message_t& m, entity_t& e);
+    id_allocator integrity_ids; //!< Allocator of integrity IDs
+    id_allocator acl_ids; //!< Allocator of ACL IDs
+    id_allocator int_fun_ids; //!< Allocator of integrity function IDs
+    sqlite::query_lease qexp_entity; //!< SQL query for exporting an entity
+    sqlite::query_lease qexp_entity_data; //!< SQL query for exporting data of an entity with an unchanged policy
+    sqlite::query_lease qexp_policy; //!< SQL query for exporting a policy blob of an entity
+    sqlite::query_lease qexp_entity_clone; //!< SQL query for copying an exported entity
+    sqlite::query_lease qexp_policy_clone; //!< SQL query for copying a policy blob of an exported entity
+    sqlite::query_lease qexp_integrity_id; //!< SQL query for inserting into INTEGRITY_ID
+    sqlite::query_lease qexp_integrity; //!< SQL query for inserting into INTEGRITY
+    sqlite::query_lease qexp_acl_id; //!< SQL query for inserting into ACL_ID
+    sqlite::query_lease qexp_acl; //!< SQL query for inserting into ACL
+    sqlite::query_lease qexp_int_fun_id; //!< SQL query for inserting int INT_FUN_ID
+    sqlite::query_lease qexp_int_fun; //!< SQL query for inserting int INT_FUN
+    sqlite::query_lease qexp_integrity_hash_get; //!< SQL query for looking up in INTEGRITY_HASH
+    sqlite::query_lease qexp_integrity_hash; //!< SQL query for inserting into INTEGRITY_HASH
+    sqlite::query_lease qexp_acl_hash_get; //!< SQL query for looking up in ACL_HASH
+    sqlite::query_lease qexp_acl_hash; //!< SQL query for inserting into ACL_HASH
+    sqlite::query_lease qexp_int_fun_hash_get; //!< SQL query for looking up in INT_FUN_HASH
+    sqlite::query_lease qexp_int_fun_hash; //!< SQL query for inserting into INT_FUN_HASH
+    sqlite::query_lease qimp_policy; //!< SQL query for importing entities with policy blobs
+    sqlite::query_lease qimp_entities; //!< SQL query for importing entities with all their parts
 };
 
-agent::agent(sqlite::connection& db):
-    qexp_entity(db, R"(insert or replace into entity values ($1, $2, $3, $4, $5, $6, $7, $8))"),
-    qexp_integrity_id(db, R"(insert into integrity_id select max(id) + 1, $1 from integrity_id returning id)"),
-    qexp_integrity(db, R"(insert into integrity values ($1, $2))"),
-    qexp_acl_id(db, R"(insert into acl_id select max(id) + 1 from acl_id returning id)"),
-    qexp_acl(db, R"(insert into acl values ($1, $2, $3))"),
-    qexp_int_fun_id(db, R"(insert into int_fun_id select max(id) + 1, $1 from int_fun_id returning id)"),
-    qexp_int_fun(db, R"(insert into int_fun values ($1, $2, $3))"),
-    qimp_entity(db, R"(
-        select name, integrity, min_integrity, acl, test_fun, prov_fun, recv_fun, data
-        from entity where name = $1)"),
-    qimp_integrity(db, R"(select universe, elem from integrity_id left join integrity using (id) where id == $1)"),
-    qimp_min_integrity(db, R"(select integrity from min_integrity where id = $1 and integrity is not null)"),
-    qimp_acl(db, R"(select op, integrity from acl where id = $1)"),
-    qimp_int_fun(db, R"(select comment, cmp, plus from int_fun_id left join int_fun using (id) where id = $1)")
+agent::agent(sqlite::connection& db, sqlite::connection& reader):
+    integrity_ids(db, "integrity_id"),
+    acl_ids(db, "acl_id"),
+    int_fun_ids(db, "int_fun_id"),
+    qexp_entity(db.cached(R"(insert or replace into entity values ($1, $2, $3, $4, $5, $6, $7, $8))")),
+    qexp_entity_data(db.cached(R"(
+        update entity set data = ?3
+        where name = ?1 and (select policy from entity_policy where name = ?1) = ?2
+        returning name)")),
+    qexp_policy(db.cached(R"(insert or replace into entity_policy values ($1, $2))")),
+    qexp_entity_clone(db.cached(R"(
+        insert or replace into entity
+            select ?2, integrity, min_integrity, acl, test_fun, prov_fun, recv_fun, data
+            from entity where name = ?1
+        returning name)")),
+    qexp_policy_clone(db.cached(R"(
+        insert or replace into entity_policy select ?2, policy from entity_policy where name = ?1)")),
+    qexp_integrity_id(db.cached(R"(insert into integrity_id values ($1, $2))")),
+    qexp_integrity(db.cached(R"(insert into integrity values ($1, $2))")),
+    qexp_acl_id(db.cached(R"(insert into acl_id values ($1))")),
+    qexp_acl(db.cached(R"(insert into acl values ($1, $2, $3))")),
+    qexp_int_fun_id(db.cached(R"(insert into int_fun_id values ($1, $2))")),
+    qexp_int_fun(db.cached(R"(insert into int_fun values ($1, $2, $3))")),
+    qexp_integrity_hash_get(db.cached(R"(select id from integrity_hash where hash = $1 and content = $2)")),
+    qexp_integrity_hash(db.cached(R"(insert into integrity_hash values ($1, $2, $3))")),
+    qexp_acl_hash_get(db.cached(R"(select id from acl_hash where hash = $1 and content = $2)")),
+    qexp_acl_hash(db.cached(R"(insert into acl_hash values ($1, $2, $3))")),
+    qexp_int_fun_hash_get(db.cached(R"(select id from int_fun_hash where hash = $1 and content = $2)")),
+    qexp_int_fun_hash(db.cached(R"(insert into int_fun_hash values ($1, $2, $3))")),
+    qimp_policy(reader.cached(R"(
+        select name, policy, data from entity join entity_policy using (name)
+        where name in (select value from json_each(?1)))")),
+    // Each row contains a part of an entity, identified by the first column:
+    // 0 = an entity, 1 = an ACL entry, 2 = a pair of an integrity function,
+    // 3 = an element of an integrity. Integrity elements are sorted.
+    qimp_entities(reader.cached(R"(
+        with
+            e as (select * from entity where name in (select value from json_each(?1))),
+            a as (select id, op, integrity from acl where id in (select min_integrity from e union select acl from e)),
+            f as (
+                select id, comment, cmp, plus from int_fun_id left join int_fun using (id)
+                where id in (select test_fun from e union select prov_fun from e union select recv_fun from e)),
+            i as (
+                select integrity as id from e union select integrity from a union
+                select cmp from f union select plus from f)
+        select 0, integrity, min_integrity, acl, test_fun, prov_fun, recv_fun, name, data from e
+        union all
+        select 1, id, integrity, null, null, null, null, op, null from a
+        union all
+        select 2, id, cmp, plus, null, null, null, comment, null from f
+        union all
+        select 3, id, universe, null, null, null, null, elem, null
+        from integrity_id left join integrity using (id) where id in (select id from i)
+        order by 1, 2, 8)"))
 {
 }
 
@@ -357,14 +1297,41 @@ soficpp::agent_result agent::export_msg(const entity_t& e, message_t& m)
 {
     try {
         m = e.name;
+        sqlite::blob_t policy = policy_blob::encode(e);
+        bool unchanged =
+            qexp_entity_data->start().bind_all(e.name, policy, e.data.str()).next_row() ==
+            sqlite::query::status::row;
+        qexp_entity_data->start(); // no query may be running during transaction commit
+        if (unchanged)
+            return soficpp::agent_result{soficpp::agent_result::success};
         int64_t id = export_msg_integrity(e.integrity());
         int64_t min_id = export_msg_acl(e.min_integrity());
         int64_t access_ctrl = export_msg_acl(e.access_ctrl());
         int64_t test_fun = export_msg_int_fun(e.test_fun());
         int64_t prov_fun = export_msg_int_fun(e.prov_fun());
         int64_t recv_fun = export_msg_int_fun(e.recv_fun());
-        qexp_entity.start().bind(1, e.name).bind(2, id).bind(3, min_id).bind(4, access_ctrl).
-            bind(5, test_fun).bind(6, prov_fun).bind(7, recv_fun).bind(8, e.data).next_row();
+        qexp_entity->start().
+            bind_all(e.name, id, min_id, access_ctrl, test_fun, prov_fun, recv_fun, e.data.str()).next_row();
+        qexp_policy->start().bind_all(e.name, policy).next_row();
+    } catch (const sqlite::busy_error&) {
+        throw; // the transaction can be retried
+    } catch (const sqlite::error& e) {
+        std::cerr << e.what();
+        return soficpp::agent_result{soficpp::agent_result::error};
+    }
+    return soficpp::agent_result{soficpp::agent_result::success};
+}
+
+soficpp::agent_result agent::clone_msg(const message_t& from, const message_t& to)
+{
+    try {
+        bool copied = qexp_entity_clone->start().bind_all(from, to).next_row() == sqlite::query::status::row;
+        qexp_entity_clone->start(); // no query may be running during transaction commit
+        if (!copied)
+            return soficpp::agent_result{soficpp::agent_result::error};
+        qexp_policy_clone->start().bind_all(from, to).next_row();
+    } catch (const sqlite::busy_error&) {
+        throw; // the transaction can be retried
     } catch (const sqlite::error& e) {
         std::cerr << e.what();
         return soficpp::agent_result{soficpp::agent_result::error};
@@ -372,245 +1339,1260 @@ soficpp::agent_result agent::export_msg(const entity_t& e, message_t& m)
     return soficpp::agent_result{soficpp::agent_result::success};
 }
 
+int64_t agent::content_hash(std::string_view content)
+{
+    return static_cast<int64_t>(fnv1a(content));
+}
+
+std::optional<int64_t> agent::find_content(sqlite::query& q, int64_t hash, const std::string& content)
+{
+    std::optional<int64_t> id{};
+    if (q.start().bind_all(hash, content).next_row() == sqlite::query::status::row) {
+        assert(q.column_count() == 1);
+        id = q.get<int64_t>(0);
+    }
+    q.start(); // no query may be running during transaction commit
+    return id;
+}
+
 int64_t agent::export_msg_acl(const acl& a)
 {
     static acl::acl_t null_acl{};
-    int64_t id = export_msg_acl(a.default_op ? *a.default_op : null_acl, std::nullopt, std::nullopt);
+    acl_ids_t ids{};
+    ids.emplace_back(std::nullopt, export_msg_acl_integrities(a.default_op ? *a.default_op : null_acl));
     for (auto&& o: a)
-        export_msg_acl(o.second ? *o.second : null_acl, o.first, id);
-    return id;
+        ids.emplace_back(o.first, export_msg_acl_integrities(o.second ? *o.second : null_acl));
+    return export_msg_acl_ids(ids);
 }
 
-int64_t agent::export_msg_acl(const acl::acl_t& a, std::optional<op_id> op, std::optional<int64_t> id)
+int64_t agent::export_msg_acl(const acl::acl_t& a)
 {
-    if (!id) {
-        auto ok = qexp_acl_id.start().next_row() == sqlite::query::status::row;
-        assert(ok);
-        assert(qexp_acl_id.column_count() == 1);
-        if (auto v = qexp_acl_id.get_column(0); auto p = std::get_if<int64_t>(&v))
-            id = *p;
-        else
-            throw export_import_error{};
-        qexp_acl_id.start(); // no query may be running during transaction commit
-    }
-    assert(id);
-    if (a.empty()) {
-        qexp_acl.start().bind(1, *id);
+    return export_msg_acl_ids(acl_ids_t{{std::nullopt, export_msg_acl_integrities(a)}});
+}
+
+std::vector<int64_t> agent::export_msg_acl_integrities(const acl::acl_t& a)
+{
+    std::vector<int64_t> ids{};
+    ids.reserve(a.size());
+    for (auto&& i: a)
+        ids.push_back(export_msg_integrity(i));
+    // Equal integrities share an ID, but table ACL does not permit duplicate
+    // rows. Removing duplicates does not change semantics of an ACL.
+    std::ranges::sort(ids);
+    auto [first, last] = std::ranges::unique(ids);
+    ids.erase(first, last);
+    return ids;
+}
+
+int64_t agent::export_msg_acl_ids(const acl_ids_t& a)
+{
+    std::string content{};
+    for (auto&& [op, ids]: a) {
         if (op)
-            qexp_acl.bind(2, soficpp::enum2str(*op));
-        else
-            qexp_acl.bind(2, nullptr);
-        qexp_acl.bind(3, nullptr).next_row();
-    } else
-        for (auto&& i: a) {
-            int64_t integrity_id = export_msg_integrity(i);
-            qexp_acl.start().bind(1, *id);
-            if (op)
-                qexp_acl.bind(2, soficpp::enum2str(*op));
+            content += soficpp::enum2sv(*op);
+        content += '=';
+        for (bool first = true; auto&& i: ids) {
+            if (first)
+                first = false;
             else
-                qexp_acl.bind(2, nullptr);
-            qexp_acl.bind(3, integrity_id).next_row();
+                content += ',';
+            content += std::to_string(i);
+        }
+        content += ';';
+    }
+    int64_t hash = content_hash(content);
+    if (auto id = find_content(*qexp_acl_hash_get, hash, content))
+        return *id;
+    int64_t id = acl_ids();
+    qexp_acl_id->start().bind(1, id).next_row();
+    for (auto&& [op, ids]: a) {
+        std::optional<std::string_view> op_name{};
+        if (op)
+            op_name = soficpp::enum2sv(*op);
+        // An empty inner ACL is stored as a single row with NULL integrity
+        for (size_t i = 0; i == 0 || i < ids.size(); ++i) {
+            qexp_acl->start().bind_all(id, op_name, ids.empty() ? std::nullopt : std::optional{ids[i]}).next_row();
         }
-    return *id;
+    }
+    qexp_acl_hash->start().bind_all(id, hash, content).next_row();
+    return id;
 }
 
 int64_t agent::export_msg_int_fun(const integrity_fun& f)
 {
-    auto ok = qexp_int_fun_id.start().bind(1, f.comment).next_row() == sqlite::query::status::row;
-    assert(ok);
-    assert(qexp_int_fun_id.column_count() == 1);
-    int64_t id = 0;
-    if (auto v = qexp_int_fun_id.get_column(0); auto p = std::get_if<int64_t>(&v))
-        id = *p;
-    else
-        throw export_import_error{};
-    qexp_int_fun_id.start(); // no query may be running during transaction commit
-    for (auto&& v: f) {
-        int64_t cmp = export_msg_integrity(v.first);
-        qexp_int_fun.start().bind(1, id).bind(2, cmp);
-        if (v.second) {
-            int64_t plus = export_msg_integrity(*v.second);
-            qexp_int_fun.bind(3, plus);
-        } else
-            qexp_int_fun.bind(3, nullptr);
-        qexp_int_fun.next_row();
+    std::vector<std::pair<int64_t, std::optional<int64_t>>> ids{};
+    ids.reserve(f.size());
+    for (auto&& v: f)
+        ids.emplace_back(export_msg_integrity(v.first),
+                         v.second ? std::optional{export_msg_integrity(*v.second)} : std::nullopt);
+    std::string content{};
+    json_quote(content, f.comment);
+    for (auto&& [cmp, plus]: ids) {
+        content += ';';
+        content += std::to_string(cmp);
+        content += '+';
+        content += plus ? std::to_string(*plus) : "null";
     }
+    int64_t hash = content_hash(content);
+    if (auto id = find_content(*qexp_int_fun_hash_get, hash, content))
+        return *id;
+    int64_t id = int_fun_ids();
+    qexp_int_fun_id->start().bind_all(id, f.comment).next_row();
+    for (auto&& [cmp, plus]: ids) {
+        qexp_int_fun->start().bind_all(id, cmp, plus).next_row();
+    }
+    qexp_int_fun_hash->start().bind_all(id, hash, content).next_row();
     return id;
 }
 
 int64_t agent::export_msg_integrity(const integrity& i)
 {
-    bool universe = i == integrity{integrity::universe{}};
-    auto ok = qexp_integrity_id.start().bind(1, universe).next_row() == sqlite::query::status::row;
-    assert(ok);
-    assert(qexp_integrity_id.column_count() == 1);
-    int64_t id = 0;
-    if (auto v = qexp_integrity_id.get_column(0); auto p = std::get_if<int64_t>(&v))
-        id = *p;
-    else
-        throw export_import_error{};
-    qexp_integrity_id.start(); // no query may be running during transaction commit
-    if (universe)
-        return id;
-    for (auto&& e: std::get<integrity::set_t>(i.value()))
-        qexp_integrity.start().bind(1, id).bind(2, e).next_row();
+    std::string content = integrity2json(i);
+    int64_t hash = content_hash(content);
+    if (auto id = find_content(*qexp_integrity_hash_get, hash, content))
+        return *id;
+    bool universe = std::holds_alternative<integrity::universe>(i.value());
+    int64_t id = integrity_ids();
+    qexp_integrity_id->start().bind_all(id, universe).next_row();
+    if (!universe)
+        for (auto&& e: std::get<integrity::set_t>(i.value()))
+            qexp_integrity->start().bind_all(id, e).next_row();
+    qexp_integrity_hash->start().bind_all(id, hash, content).next_row();
     return id;
 }
 
 soficpp::agent_result agent::import_msg(const message_t& m, entity_t& e)
 {
+    std::vector<entity_t> imported{};
+    auto result = import_msgs({m}, imported);
+    if (result)
+        e = std::move(imported.front());
+    return result;
+}
+
+soficpp::agent_result agent::import_msgs(const std::vector<message_t>& m, std::vector<entity_t>& e)
+{
+    auto json_names = [&m](auto&& pred) {
+        std::string names{'['};
+        bool first = true;
+        for (size_t i = 0; i < m.size(); ++i)
+            if (pred(i)) {
+                if (first)
+                    first = false;
+                else
+                    names += ',';
+                json_quote(names, m[i]);
+            }
+        names += ']';
+        return names;
+    };
     try {
-        qimp_entity.start().bind(1, m);
-        if (qimp_entity.next_row() == sqlite::query::status::done)
-            return soficpp::agent_result{soficpp::agent_result::error};
-        assert(qimp_entity.column_count() == 8);
-        if (auto v = qimp_entity.get_column(0); auto p = std::get_if<std::string>(&v))
-            e.name = *p;
-        else
-            return soficpp::agent_result{soficpp::agent_result::error};
-        if (auto v = qimp_entity.get_column(1); auto p = std::get_if<int64_t>(&v))
-            e.integrity() = import_msg_integrity(*p);
-        else
-            return soficpp::agent_result{soficpp::agent_result::error};
-        if (auto v = qimp_entity.get_column(2); auto p = std::get_if<int64_t>(&v))
-            e.min_integrity() = import_msg_min_integrity(*p);
-        else
-            return soficpp::agent_result{soficpp::agent_result::error};
-        if (auto v = qimp_entity.get_column(3); auto p = std::get_if<int64_t>(&v))
-            e.access_ctrl() = import_msg_acl(*p);
-        else
-            return soficpp::agent_result{soficpp::agent_result::error};
-        if (auto v = qimp_entity.get_column(4); auto p = std::get_if<int64_t>(&v))
-            std::tie(e.test_fun(), e.test_fun_name) = import_msg_int_fun(*p);
-        else
-            return soficpp::agent_result{soficpp::agent_result::error};
-        if (auto v = qimp_entity.get_column(5); auto p = std::get_if<int64_t>(&v))
-            std::tie(e.prov_fun(), e.prov_fun_name) = import_msg_int_fun(*p);
-        else
-            return soficpp::agent_result{soficpp::agent_result::error};
-        if (auto v = qimp_entity.get_column(6); auto p = std::get_if<int64_t>(&v))
-            std::tie(e.recv_fun(), e.recv_fun_name) = import_msg_int_fun(*p);
-        else
-            return soficpp::agent_result{soficpp::agent_result::error};
-        if (auto v = qimp_entity.get_column(7); auto p = std::get_if<std::string>(&v))
-            e.data = *p;
-        else
-            return soficpp::agent_result{soficpp::agent_result::error};
-        qimp_entity.start(); // no query may be running during transaction commit
+        e.clear();
+        e.resize(m.size());
+        // Entities with policy blobs
+        std::vector<bool> imported(m.size(), false);
+        auto& q = *qimp_policy;
+        std::string names = json_names([](size_t) { return true; });
+        for (q.start().bind(1, names); q.next_row() == sqlite::query::status::row;) {
+            assert(q.column_count() == 3);
+            using ct = sqlite::query::column_type;
+            if (q.get_column_type(1) != ct::ct_blob || q.get_column_type(2) != ct::ct_string)
+                throw export_import_error{};
+            auto policy = q.get_blob(1);
+            auto name = q.get_text(0);
+            for (size_t i = 0; i < m.size(); ++i)
+                if (m[i] == name) {
+                    try {
+                        policy_blob::decode(policy, e[i]);
+                    } catch (const std::invalid_argument&) {
+                        throw export_import_error{};
+                    }
+                    e[i].name = m[i];
+                    e[i].data = q.get_text(2);
+                    imported[i] = true;
+                }
+        }
+        q.start(); // no query may be running during transaction commit
+        // Other entities from normalized tables
+        if (std::ranges::find(imported, false) != imported.end()) {
+            auto rows = import_msg_rows(json_names([&imported](size_t i) { return !imported[i]; }));
+            for (size_t i = 0; i < m.size(); ++i)
+                if (!imported[i])
+                    import_msg_entity(rows, m[i], e[i]);
+        }
     } catch (const export_import_error&) {
+        qimp_policy->start(); // no query may be running during transaction commit
+        qimp_entities->start();
         return soficpp::agent_result{soficpp::agent_result::error};
+    } catch (const sqlite::busy_error&) {
+        qimp_policy->start(); // no query may be running during transaction commit
+        qimp_entities->start();
+        throw; // the transaction can be retried
     } catch (const sqlite::error& e) {
         std::cerr << e.what();
+        qimp_policy->start(); // no query may be running during transaction commit
+        qimp_entities->start();
         return soficpp::agent_result{soficpp::agent_result::error};
     }
     return soficpp::agent_result{soficpp::agent_result::success};
 }
 
-acl agent::import_msg_acl(int64_t id)
+auto agent::import_msg_rows(const std::string& names) -> import_rows
 {
-    qimp_acl.start().bind(1, id);
-    acl result;
-    while (qimp_acl.next_row() == sqlite::query::status::row) {
-        assert(qimp_acl.column_count() == 2);
-        auto& pacl = [&, this]() -> std::shared_ptr<acl::acl_t>& {
-            auto v = qimp_acl.get_column(0);
-            if (std::holds_alternative<std::nullptr_t>(v)) {
-                return result.default_op;
-            } else if (auto p = std::get_if<std::string>(&v))
-                try {
-                    return result[soficpp::str2enum<op_id>(*p)];
-                } catch (const std::invalid_argument&) {
-                    throw export_import_error{};
+    using ct = sqlite::query::column_type;
+    import_rows rows{};
+    auto& q = *qimp_entities;
+    auto id = [&q](int i) {
+        return q.get<int64_t>(i);
+    };
+    auto opt_id = [&q](int i) {
+        return q.get<std::optional<int64_t>>(i);
+    };
+    // Elements of an integrity are collected, and the integrity is stored when
+    // a row of another integrity is encountered.
+    std::optional<int64_t> int_id{};
+    bool int_universe = false;
+    integrity::set_t int_set{};
+    auto int_done = [&]() {
+        if (int_id)
+            rows.integrities.emplace(*int_id,
+                                     int_universe ? integrity{integrity::universe{}} : integrity{std::move(int_set)});
+        int_set.clear();
+    };
+    for (q.start().bind(1, names); q.next_row() == sqlite::query::status::row;) {
+        assert(q.column_count() == 9);
+        switch (q.get_int64(0)) {
+        case 0:
+            {
+                auto [kind, integrity, min_integrity, acl, test_fun, prov_fun, recv_fun, name, data] =
+                    q.row<int64_t, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t,
+                    std::string_view, std::string_view>();
+                rows.entities[std::string{name}] = {
+                    .integrity = integrity,
+                    .min_integrity = min_integrity,
+                    .acl = acl,
+                    .test_fun = test_fun,
+                    .prov_fun = prov_fun,
+                    .recv_fun = recv_fun,
+                    .data = std::string{data},
+                };
+            }
+            break;
+        case 1:
+            {
+                std::optional<op_id> op{};
+                if (q.get_column_type(7) != ct::ct_null) {
+                    if (auto o = operation::find(q.get_text(7)))
+                        op = o->id();
+                    else
+                        throw export_import_error{};
                 }
-            else
-                throw export_import_error{};
-        }();
-        if (!pacl)
-            pacl = std::make_shared<acl::acl_t>();
-        auto v = qimp_acl.get_column(1);
-        if (std::holds_alternative<std::nullptr_t>(v))
-            ;
-        else if (auto p = std::get_if<int64_t>(&v))
-            pacl->push_back(import_msg_integrity(*p));
-        else
+                rows.acls[id(1)].emplace_back(op, opt_id(2));
+            }
+            break;
+        case 2:
+            {
+                auto& f = rows.funs[id(1)];
+                f.first = q.get_text(7);
+                if (auto cmp = opt_id(2))
+                    f.second.emplace_back(*cmp, opt_id(3));
+            }
+            break;
+        case 3:
+            if (int64_t i = id(1); i != int_id) {
+                int_done();
+                int_id = i;
+                if (q.get_column_type(2) != ct::ct_int64)
+                    throw export_import_error{};
+                int_universe = q.get_int64(2);
+            }
+            if (q.get_column_type(7) != ct::ct_null)
+                int_set.emplace_hint(int_set.end(), q.get_text(7));
+            break;
+        default:
             throw export_import_error{};
+        }
     }
-    return result;
+    int_done();
+    q.start(); // no query may be running during transaction commit
+    return rows;
 }
 
-std::pair<integrity_fun, std::string> agent::import_msg_int_fun(int64_t id)
+void agent::import_msg_entity(const import_rows& rows, const message_t& m, entity_t& e)
 {
-    qimp_int_fun.start().bind(1, id);
-    integrity_fun result;
-    while (qimp_int_fun.next_row() == sqlite::query::status::row) {
-        assert(qimp_int_fun.column_count() == 3);
-        if (result.comment.empty()) {
-            auto v = qimp_int_fun.get_column(0);
-            if (std::holds_alternative<std::nullptr_t>(v))
-                ;
-            else if (auto p = std::get_if<std::string>(&v))
-                result.comment = std::move(*p);
-            else
-                throw export_import_error{};
+    auto get_integrity = [&rows](int64_t id) -> const integrity& {
+        if (auto i = rows.integrities.find(id); i != rows.integrities.end())
+            return i->second;
+        throw export_import_error{};
+    };
+    auto it = rows.entities.find(m);
+    if (it == rows.entities.end())
+        throw export_import_error{};
+    auto& r = it->second;
+    e.name = m;
+    e.data = r.data;
+    e.integrity() = get_integrity(r.integrity);
+    // Minimum integrity is the default entry of an ACL
+    min_integrity mi{};
+    if (auto a = rows.acls.find(r.min_integrity); a != rows.acls.end())
+        for (auto&& [op, i]: a->second)
+            if (!op && i)
+                mi.push_back(get_integrity(*i));
+    e.min_integrity() = std::move(mi);
+    acl ac{};
+    if (auto a = rows.acls.find(r.acl); a != rows.acls.end())
+        for (auto&& [op, i]: a->second) {
+            auto& pacl = op ? ac[*op] : ac.default_op;
+            if (!pacl)
+                pacl = std::make_shared<acl::acl_t>();
+            if (i)
+                pacl->push_back(get_integrity(*i));
         }
-        auto vcmp = qimp_int_fun.get_column(1);
-        if (std::holds_alternative<std::nullptr_t>(vcmp))
-            ;
-        else if (auto pcmp = std::get_if<std::int64_t>(&vcmp)) {
-            auto vplus = qimp_int_fun.get_column(2);
-            if (std::holds_alternative<std::nullptr_t>(vplus))
-                result.emplace_back(import_msg_integrity(*pcmp), std::nullopt);
-            else if (auto pplus = std::get_if<std::int64_t>(&vplus))
-                result.emplace_back(import_msg_integrity(*pcmp), import_msg_integrity(*pplus));
-            else
-                throw export_import_error{};
-        } else
-            throw export_import_error{};
+    e.access_ctrl() = std::move(ac);
+    auto get_fun = [&rows, &get_integrity](int64_t id, integrity_fun& f, std::string& name) {
+        f = integrity_fun{};
+        if (auto fi = rows.funs.find(id); fi != rows.funs.end()) {
+            f.comment = fi->second.first;
+            for (auto&& [cmp, plus]: fi->second.second)
+                f.emplace_back(get_integrity(cmp),
+                               plus ? std::optional{get_integrity(*plus)} : std::nullopt);
+        }
+        name = f.comment;
+    };
+    get_fun(r.test_fun, e.test_fun(), e.test_fun_name);
+    get_fun(r.prov_fun, e.prov_fun(), e.prov_fun_name);
+    get_fun(r.recv_fun, e.recv_fun(), e.recv_fun_name);
+}
+
+//! A read-only memory mapping of a whole file
+class mapped_file {
+public:
+    //! Maps a file.
+    /*! \param[in] name a file name
+     * \throw std::system_error if the file cannot be mapped */
+    explicit mapped_file(const std::string& name);
+    //! No copy
+    mapped_file(const mapped_file&) = delete;
+    //! No move
+    mapped_file(mapped_file&&) = delete;
+    //! Unmaps the file.
+    ~mapped_file();
+    //! No copy
+    mapped_file& operator=(const mapped_file&) = delete;
+    //! No move
+    mapped_file& operator=(mapped_file&&) = delete;
+    //! Gets the contents of the file.
+    /*! \return the mapped memory */
+    [[nodiscard]] std::span<const unsigned char> data() const noexcept {
+        return {static_cast<const unsigned char*>(_addr), _size};
+    }
+private:
+    void* _addr = nullptr; //!< The mapped memory
+    size_t _size = 0; //!< The size of the file
+};
+
+mapped_file::mapped_file(const std::string& name)
+{
+    int fd = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), name);
+    struct stat st{};
+    if (::fstat(fd, &st) != 0) {
+        int e = errno;
+        ::close(fd);
+        throw std::system_error(e, std::generic_category(), name);
+    }
+    _size = size_t(st.st_size);
+    if (_size > 0)
+        _addr = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int e = errno;
+    ::close(fd);
+    if (_addr == MAP_FAILED) {
+        _addr = nullptr;
+        throw std::system_error(e, std::generic_category(), name);
     }
-    return {result, result.comment};
 }
 
-integrity agent::import_msg_integrity(int64_t id)
+mapped_file::~mapped_file()
+{
+    if (_addr)
+        ::munmap(_addr, _size);
+}
+
+//! Writes a buffer to a file.
+/*! Writing is retried if interrupted by a signal.
+ * \param[in] fd a file descriptor
+ * \param[in] b data to be written
+ * \param[in] name the file name used in an error message
+ * \throw std::system_error if writing fails */
+void write_all(int fd, std::span<const unsigned char> b, const std::string& name)
 {
-    qimp_integrity.start().bind(1, id);
-    integrity::set_t result{};
-    bool row = false;
-    while (qimp_integrity.next_row() == sqlite::query::status::row) {
-        assert(qimp_integrity.column_count() == 2);
-        row = true;
-        auto e = qimp_integrity.get_column(1);
-        if (std::holds_alternative<std::nullptr_t>(e)) {
-            auto u = qimp_integrity.get_column(0);
-            if (auto p = std::get_if<int64_t>(&u)) {
-                if (*p) {
-                    qimp_integrity.start(); // no query may be running during transaction commit
-                    return integrity{integrity::universe{}};
+    while (!b.empty()) {
+        ssize_t n = ::write(fd, b.data(), b.size());
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), name);
+        }
+        b = b.subspan(size_t(n));
+    }
+}
+
+//! Makes changes of directory entries durable.
+/*! It must be called after a file in a directory is created or renamed.
+ * \param[in] file a file name, its parent directory is synchronized
+ * \throw std::system_error if the directory cannot be synchronized */
+void sync_dir(const std::string& file)
+{
+    std::filesystem::path dir = std::filesystem::path{file}.parent_path();
+    if (dir.empty())
+        dir = ".";
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), dir.string());
+    if (::fsync(fd) != 0) {
+        int e = errno;
+        ::close(fd);
+        throw std::system_error(e, std::generic_category(), dir.string());
+    }
+    ::close(fd);
+}
+
+//! Atomically and durably replaces the contents of a file.
+/*! The data are written to temporary file <tt><em>name</em>.tmp</tt>, which is
+ * synchronized to the disk and renamed to \a name. Then the directory is
+ * synchronized. If the program or the system crashes, the file contains
+ * either the old or the new data. After this function returns, the new data
+ * are durable.
+ * \param[in] name a file name
+ * \param[in] b the new contents of the file
+ * \throw std::system_error if writing fails */
+void write_file_atomic(const std::string& name, std::span<const unsigned char> b)
+{
+    std::string tmp = name + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), tmp);
+    try {
+        write_all(fd, b, tmp);
+        if (::fsync(fd) != 0)
+            throw std::system_error(errno, std::generic_category(), tmp);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+    std::filesystem::rename(tmp, name);
+    sync_dir(name);
+}
+
+//! An agent that persists entities in an append-only log with periodic snapshots
+/*! It is an alternative to storing entities in table \c entity of the
+ * database. All entities are kept in memory. Each entity changed by
+ * export_msg() or erase() is appended to file <tt><em>file</em>.log</tt> as
+ * a record containing the whole entity, with its policy encoded by
+ * policy_blob. Records of a batch of operations are buffered and written by
+ * commit(), which appends a commit record and calls \c fdatasync() once for
+ * the whole batch (group commit). Changes become visible to import_msg() after
+ * apply().
+ *
+ * When the log grows over \ref snapshot_size, snapshot() writes all entities
+ * to file <tt><em>file</em>.snap</tt> by write_file_atomic() and then
+ * truncates the log. The constructor maps the snapshot into memory, decodes
+ * entities from it, and replays the log.
+ *
+ * Each record starts with the size and a checksum of its content, so that an
+ * incomplete record written before a crash is detected. A commit record
+ * contains the ID of the last request of its batch. The batch is replayed only
+ * if its requests have been committed to the database, otherwise it is
+ * discarded and the log is truncated. Replaying a batch repeatedly is
+ * harmless, because records contain whole entities. */
+class log_agent {
+public:
+    //! The entity type
+    using entity_t = entity;
+    //! The message type is the name of the entity
+    using message_t = std::string;
+    //! The type of a predicate telling if the request with a given ID has been committed to the database
+    using committed_t = std::function<bool(int64_t)>;
+    //! The size of the log that triggers a snapshot
+    static constexpr size_t snapshot_size = size_t{16} << 20;
+    //! Loads entities from the snapshot and the log, and opens the log for appending.
+    /*! \param[in] file the database file name, used as the prefix of file
+     * names of the snapshot and the log
+     * \param[in] committed used to select batches of the log to be replayed
+     * \throw std::system_error if a file cannot be read or written
+     * \throw std::runtime_error if the snapshot is invalid */
+    log_agent(std::string_view file, const committed_t& committed);
+    //! No copy
+    log_agent(const log_agent&) = delete;
+    //! No move
+    log_agent(log_agent&&) = delete;
+    //! Closes the log.
+    ~log_agent();
+    //! No copy
+    log_agent& operator=(const log_agent&) = delete;
+    //! No move
+    log_agent& operator=(log_agent&&) = delete;
+    //! Checks if entities of a database are stored by a log_agent.
+    /*! \param[in] file the database file name
+     * \return whether the snapshot file exists */
+    static bool exists(std::string_view file) {
+        return std::filesystem::exists(snap_name(file));
+    }
+    //! Deletes the snapshot and the log.
+    /*! \param[in] file the database file name */
+    static void remove(std::string_view file) {
+        std::filesystem::remove(log_name(file));
+        std::filesystem::remove(snap_name(file));
+    }
+    //! The export operation
+    /*! It stages the entity to be written by commit().
+     * \param[in] e an entity
+     * \param[out] m a message
+     * \return the result of export, always success */
+    soficpp::agent_result export_msg(const entity_t& e, message_t& m);
+    //! The import operation
+    /*! Entities exported, but not yet applied, are not visible.
+     * \param[in] m a message (an entity name)
+     * \param[out] e an entity
+     * \return the result of import, an error if there is no entity \a m */
+    soficpp::agent_result import_msg(const message_t& m, entity_t& e);
+    //! The import operation for a batch of entities
+    /*! \param[in] m messages (entity names)
+     * \param[out] e imported entities, in the same order as \a m
+     * \return the result of import, an error if any of the entities cannot be
+     * imported */
+    soficpp::agent_result import_msgs(const std::vector<message_t>& m, std::vector<entity_t>& e);
+    //! Stages an entity to be deleted by commit().
+    /*! \param[in] name an entity name */
+    void erase(const std::string& name);
+    //! Discards all staged changes.
+    /*! It must be called before a rolled back transaction is retried. */
+    void rollback() noexcept {
+        _buf.clear();
+        _staged.clear();
+    }
+    //! Writes staged changes and a commit record to the log and waits until they are stored.
+    /*! \param[in] last_request the ID of the last request of the batch
+     * \throw std::system_error if writing fails */
+    void commit(int64_t last_request);
+    //! Makes committed changes visible.
+    /*! It must be called after the requests passed to commit() have been
+     * committed to the database. It takes a snapshot if the log is larger
+     * than \ref snapshot_size.
+     * \throw std::system_error if taking a snapshot fails */
+    void apply();
+    //! Replaces all entities and takes a snapshot.
+    /*! It is used to initialize the store from the database.
+     * \param[in] entities new entities
+     * \throw std::system_error if taking a snapshot fails */
+    void assign(std::vector<entity_t> entities);
+    //! Writes all entities to the snapshot and truncates the log.
+    /*! \throw std::system_error if writing fails */
+    void snapshot();
+    //! Gets all entities.
+    /*! \return the entities, indexed by names */
+    [[nodiscard]] const std::map<std::string, entity_t, std::less<>>& entities() const noexcept {
+        return _entities;
+    }
+private:
+    //! Kinds of records
+    enum class kind: unsigned char {
+        put = 1, //!< A new value of an entity
+        erase = 2, //!< A deleted entity
+        commit = 3, //!< The end of a batch
+    };
+    //! Staged changes of entities, \c std::nullopt if deleted
+    using staged_t = std::vector<std::pair<std::string, std::optional<entity_t>>>;
+    //! The magic string at the start of the log file
+    static constexpr std::string_view log_magic{"SOFILOG\1", 8};
+    //! The magic string at the start of the snapshot file
+    static constexpr std::string_view snap_magic{"SOFISNP\1", 8};
+    //! The size of a record header (the size and the checksum of the content)
+    static constexpr size_t header_size = 8;
+    //! Gets the log file name.
+    /*! \param[in] file the database file name
+     * \return the log file name */
+    static std::string log_name(std::string_view file) {
+        return std::string{file} + ".log";
+    }
+    //! Gets the snapshot file name.
+    /*! \param[in] file the database file name
+     * \return the snapshot file name */
+    static std::string snap_name(std::string_view file) {
+        return std::string{file} + ".snap";
+    }
+    //! Computes the checksum of a record.
+    /*! \param[in] content the content of a record
+     * \return the checksum */
+    static uint32_t checksum(std::span<const unsigned char> content);
+    //! Appends a record.
+    /*! \param[in, out] b a buffer
+     * \param[in] k the kind of the record
+     * \param[in] content a function that appends the content after the kind */
+    template <std::invocable<sqlite::blob_t&> F> static void put_record(sqlite::blob_t& b, kind k, F&& content);
+    //! Appends a record containing an entity.
+    /*! \param[in, out] b a buffer
+     * \param[in] e an entity */
+    static void put_entity(sqlite::blob_t& b, const entity_t& e);
+    //! Reads an entity from a record.
+    /*! \param[in] r a reader of the record content after the kind
+     * \return the entity
+     * \throw std::invalid_argument if the record is invalid */
+    static entity_t get_entity(policy_blob::reader& r);
+    //! Decodes records.
+    /*! Decoding stops at the first incomplete record or a record with an
+     * invalid checksum.
+     * \param[in] s records
+     * \param[in] f a function called for each record with the kind, a reader
+     * of the content after the kind, and the position after the record
+     * \return the size of decoded records */
+    template <class F> static size_t parse(std::span<const unsigned char> s, F&& f);
+    //! Throws an exception for the last failed system call.
+    /*! \param[in] name a file name
+     * \throw std::system_error always */
+    [[noreturn]] static void system_error(const std::string& name) {
+        throw std::system_error(errno, std::generic_category(), name);
+    }
+    std::string _log_name; //!< The log file name
+    std::string _snap_name; //!< The snapshot file name
+    int _fd = -1; //!< The log file descriptor
+    size_t _log_size = 0; //!< The size of the log
+    std::map<std::string, entity_t, std::less<>> _entities{}; //!< Committed entities
+    staged_t _staged{}; //!< Changes of entities not yet applied
+    sqlite::blob_t _buf{}; //!< Records not yet written to the log
+};
+
+static_assert(soficpp::agent<log_agent>);
+
+log_agent::log_agent(std::string_view file, const committed_t& committed):
+    _log_name(log_name(file)), _snap_name(snap_name(file))
+{
+    auto has_magic = [](std::span<const unsigned char> s, std::string_view magic) {
+        return s.size() >= magic.size() && std::ranges::equal(s.first(magic.size()), magic, {}, {},
+                                                              [](char c) { return static_cast<unsigned char>(c); });
+    };
+    if (std::filesystem::exists(_snap_name)) {
+        mapped_file snap{_snap_name};
+        auto s = snap.data();
+        if (!has_magic(s, snap_magic))
+            throw std::runtime_error("Invalid snapshot file \"" + _snap_name + "\"");
+        s = s.subspan(snap_magic.size());
+        size_t n = parse(s, [this](kind k, policy_blob::reader& r, size_t) {
+            if (k != kind::put)
+                policy_blob::invalid();
+            auto e = get_entity(r);
+            std::string name = e.name;
+            _entities.insert_or_assign(std::move(name), std::move(e));
+        });
+        if (n != s.size())
+            throw std::runtime_error("Incomplete snapshot file \"" + _snap_name + "\"");
+    }
+    // The size of the log up to the end of the last committed batch
+    size_t committed_size = 0;
+    if (std::filesystem::exists(_log_name)) {
+        mapped_file log{_log_name};
+        auto s = log.data();
+        if (has_magic(s, log_magic)) {
+            s = s.subspan(log_magic.size());
+            committed_size = log_magic.size();
+            staged_t batch{};
+            parse(s, [&](kind k, policy_blob::reader& r, size_t end) {
+                switch (k) {
+                case kind::put:
+                    {
+                        auto e = get_entity(r);
+                        std::string name = e.name;
+                        batch.emplace_back(std::move(name), std::move(e));
+                    }
+                    break;
+                case kind::erase:
+                    batch.emplace_back(std::string{r.str()}, std::nullopt);
+                    break;
+                case kind::commit:
+                    if (committed(int64_t(r.num()))) {
+                        for (auto&& [name, e]: batch)
+                            if (e)
+                                _entities.insert_or_assign(std::move(name), std::move(*e));
+                            else
+                                _entities.erase(name);
+                        committed_size = log_magic.size() + end;
+                    }
+                    batch.clear();
+                    break;
+                default:
+                    policy_blob::invalid();
                 }
-                // not universe => empty set
-            } else
-                throw export_import_error{};
-        } else if (auto p = std::get_if<std::string>(&e)) {
-            result.insert(std::move(*p));
-        } else
-            throw export_import_error{};
+            });
+        }
     }
-    if (!row)
-        throw export_import_error{};
-    return integrity{result};
+    _fd = ::open(_log_name.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if (_fd < 0)
+        system_error(_log_name);
+    try {
+        // Discard uncommitted batches and an incomplete record
+        if (::ftruncate(_fd, off_t(committed_size)) != 0)
+            system_error(_log_name);
+        bool created = committed_size == 0;
+        if (created) {
+            write_all(_fd, {reinterpret_cast<const unsigned char*>(log_magic.data()), log_magic.size()}, _log_name);
+            committed_size = log_magic.size();
+        }
+        if (::fdatasync(_fd) != 0)
+            system_error(_log_name);
+        // A new log must not disappear after its batches are committed
+        if (created)
+            sync_dir(_log_name);
+    } catch (...) {
+        ::close(_fd);
+        throw;
+    }
+    _log_size = committed_size;
+}
+
+log_agent::~log_agent()
+{
+    ::close(_fd);
+}
+
+soficpp::agent_result log_agent::export_msg(const entity_t& e, message_t& m)
+{
+    m = e.name;
+    put_entity(_buf, e);
+    _staged.emplace_back(e.name, e);
+    return soficpp::agent_result{soficpp::agent_result::success};
+}
+
+soficpp::agent_result log_agent::import_msg(const message_t& m, entity_t& e)
+{
+    auto it = _entities.find(m);
+    if (it == _entities.end())
+        return soficpp::agent_result{soficpp::agent_result::error};
+    e = it->second;
+    return soficpp::agent_result{soficpp::agent_result::success};
 }
 
-min_integrity agent::import_msg_min_integrity(int64_t id)
+soficpp::agent_result log_agent::import_msgs(const std::vector<message_t>& m, std::vector<entity_t>& e)
 {
-    qimp_min_integrity.start().bind(1, id);
-    min_integrity result{};
-    while (qimp_min_integrity.next_row() == sqlite::query::status::row) {
-        assert(qimp_min_integrity.column_count() ==  1);
-        if (auto v = qimp_min_integrity.get_column(0); auto p = std::get_if<int64_t>(&v))
-            result.push_back(import_msg_integrity(*p));
+    e.resize(m.size());
+    for (size_t i = 0; i < m.size(); ++i)
+        if (auto result = import_msg(m[i], e[i]); !result)
+            return result;
+    return soficpp::agent_result{soficpp::agent_result::success};
+}
+
+void log_agent::erase(const std::string& name)
+{
+    put_record(_buf, kind::erase, [&name](sqlite::blob_t& b) { policy_blob::put(b, std::string_view{name}); });
+    _staged.emplace_back(name, std::nullopt);
+}
+
+void log_agent::commit(int64_t last_request)
+{
+    put_record(_buf, kind::commit, [last_request](sqlite::blob_t& b) { policy_blob::put(b, uint64_t(last_request)); });
+    write_all(_fd, _buf, _log_name);
+    if (::fdatasync(_fd) != 0)
+        system_error(_log_name);
+    _log_size += _buf.size();
+    _buf.clear();
+}
+
+void log_agent::apply()
+{
+    for (auto&& [name, e]: _staged)
+        if (e)
+            _entities.insert_or_assign(std::move(name), std::move(*e));
         else
-            throw export_import_error{};
+            _entities.erase(name);
+    _staged.clear();
+    if (_log_size > snapshot_size)
+        snapshot();
+}
+
+void log_agent::assign(std::vector<entity_t> entities)
+{
+    _entities.clear();
+    for (auto&& e: entities) {
+        std::string name = e.name;
+        _entities.insert_or_assign(std::move(name), std::move(e));
     }
-    return result;
+    snapshot();
+}
+
+void log_agent::snapshot()
+{
+    sqlite::blob_t b{snap_magic.begin(), snap_magic.end()};
+    for (auto&& e: _entities)
+        put_entity(b, e.second);
+    // The log may be truncated only after the new snapshot is durable,
+    // including its directory entry. If the program terminates before
+    // truncating the log, the log is replayed over the snapshot, which yields
+    // the same entities.
+    write_file_atomic(_snap_name, b);
+    if (::ftruncate(_fd, off_t(log_magic.size())) != 0 || ::fdatasync(_fd) != 0)
+        system_error(_log_name);
+    _log_size = log_magic.size();
+}
+
+uint32_t log_agent::checksum(std::span<const unsigned char> content)
+{
+    return static_cast<uint32_t>(fnv1a({reinterpret_cast<const char*>(content.data()), content.size()}));
+}
+
+template <std::invocable<sqlite::blob_t&> F> void log_agent::put_record(sqlite::blob_t& b, kind k, F&& content)
+{
+    size_t start = b.size();
+    b.resize(start + header_size);
+    b.push_back(static_cast<unsigned char>(k));
+    std::invoke(std::forward<F>(content), b);
+    auto size = static_cast<uint32_t>(b.size() - start - header_size);
+    uint32_t sum = checksum(std::span{b}.subspan(start + header_size));
+    for (size_t i = 0; i < 4; ++i) {
+        b[start + i] = static_cast<unsigned char>(size >> (8 * i));
+        b[start + 4 + i] = static_cast<unsigned char>(sum >> (8 * i));
+    }
+}
+
+void log_agent::put_entity(sqlite::blob_t& b, const entity_t& e)
+{
+    put_record(b, kind::put, [&e](sqlite::blob_t& b) {
+        sqlite::blob_t policy = policy_blob::encode(e);
+        policy_blob::put(b, std::string_view{e.name});
+        policy_blob::put(b, std::string_view{reinterpret_cast<const char*>(policy.data()), policy.size()});
+        // Data are copied chunk by chunk, without flattening
+        policy_blob::put(b, uint64_t(e.data.size()));
+        for (auto&& c: e.data.chunks())
+            b.insert(b.end(), c->begin(), c->end());
+    });
+}
+
+log_agent::entity_t log_agent::get_entity(policy_blob::reader& r)
+{
+    entity_t e{};
+    e.name = r.str();
+    std::string_view policy = r.str();
+    policy_blob::decode({reinterpret_cast<const unsigned char*>(policy.data()), policy.size()}, e);
+    e.data = r.str();
+    if (!r.end())
+        policy_blob::invalid();
+    return e;
+}
+
+template <class F> size_t log_agent::parse(std::span<const unsigned char> s, F&& f)
+{
+    size_t pos = 0;
+    while (s.size() - pos >= header_size) {
+        uint32_t size = 0;
+        uint32_t sum = 0;
+        for (size_t i = 0; i < 4; ++i) {
+            size |= uint32_t(s[pos + i]) << (8 * i);
+            sum |= uint32_t(s[pos + 4 + i]) << (8 * i);
+        }
+        if (size == 0 || s.size() - pos - header_size < size)
+            break;
+        auto content = s.subspan(pos + header_size, size);
+        if (checksum(content) != sum)
+            break;
+        pos += header_size + size;
+        policy_blob::reader r{content.subspan(1)};
+        f(kind{content.front()}, r, pos);
+    }
+    return pos;
+}
+
+//! A compiled, read-only image of all entities
+/*! An image is created by compile() from entities of a database and stored in
+ * file <tt><em>file</em>.policy</tt>. It is used by mapping the file into
+ * memory, without reading or parsing it as a whole, therefore, entities can be
+ * imported immediately after start, regardless of their number.
+ *
+ * The image is position independent. It consists of 32-bit little-endian
+ * words, and values are referenced by their offsets from the start of the
+ * file, with 0 denoting no value. Equal strings and equal structures are
+ * stored only once and shared by all entities. The image contains:
+ * \arg header -- a magic string, the number of entities, and the offset of
+ * the entity table
+ * \arg string -- the length, followed by characters padded to whole words
+ * \arg integrity -- \ref universe for the universe, otherwise the number of
+ * elements, followed by references to elements (strings) in ascending order
+ * \arg minimum integrity or inner ACL -- the number of integrities,
+ * followed by references to integrities
+ * \arg ACL -- a reference to the default inner ACL, the number of
+ * operations, and pairs (operation name, inner ACL)
+ * \arg integrity function -- the comment, the number of pairs, and pairs
+ * (integrity, integrity or 0)
+ * \arg entity table -- for each entity, sorted by names: the name, the
+ * integrity, the minimum integrity, the ACL, the testing, providing, and
+ * receiving functions, and the data
+ *
+ * Parts of entities are decoded on first use and cached by their offsets.
+ * Entities imported from the image share decoded inner ACLs. The image
+ * contains entities as they were when it was compiled, and it is not changed
+ * by exporting. */
+class policy_image {
+public:
+    //! The entity type
+    using entity_t = entity;
+    //! The message type is the name of the entity
+    using message_t = std::string;
+    //! Maps an image into memory.
+    /*! \param[in] file the database file name
+     * \throw std::system_error if the image file cannot be mapped
+     * \throw std::invalid_argument if the file is not a valid image */
+    explicit policy_image(std::string_view file);
+    //! Gets the image file name.
+    /*! \param[in] file the database file name
+     * \return the image file name */
+    static std::string file_name(std::string_view file) {
+        return std::string{file} + ".policy";
+    }
+    //! Creates an image.
+    /*! The image atomically replaces any existing image, see
+     * write_file_atomic().
+     * \param[in] file the database file name
+     * \param[in] entities entities to be stored in the image
+     * \throw std::system_error if the image file cannot be written
+     * \throw std::length_error if the image would be larger than 4 GiB */
+    static void compile(std::string_view file, const std::vector<entity_t>& entities);
+    //! The export operation
+    /*! The image is read-only, therefore, it always fails.
+     * \return an error */
+    soficpp::agent_result export_msg(const entity_t&, message_t&) {
+        return soficpp::agent_result{soficpp::agent_result::error};
+    }
+    //! The import operation
+    /*! It finds the entity by binary search in the entity table.
+     * \param[in] m a message (an entity name)
+     * \param[out] e an entity
+     * \return the result of import, an error if there is no entity \a m
+     * \throw std::invalid_argument if the image is invalid */
+    soficpp::agent_result import_msg(const message_t& m, entity_t& e);
+    //! Gets the number of entities.
+    /*! \return the number of entities in the image */
+    [[nodiscard]] size_t size() const noexcept {
+        return _entities;
+    }
+private:
+    //! Creates the contents of an image
+    class builder;
+    //! The magic string at the start of the image
+    static constexpr std::string_view magic{"SOFIPOL\1", 8};
+    //! The size of the header
+    static constexpr uint32_t header_size = 16;
+    //! The number of elements denoting the universe integrity
+    static constexpr uint32_t universe = 0xffffffff;
+    //! The number of words of an item of the entity table
+    static constexpr uint32_t entity_words = 8;
+    //! Reads a word.
+    /*! \param[in] off an offset
+     * \return the word
+     * \throw std::invalid_argument if \a off is outside the image */
+    [[nodiscard]] uint32_t word(size_t off) const;
+    //! Reads a string.
+    /*! \param[in] off an offset of a string
+     * \return the string, valid as long as the image
+     * \throw std::invalid_argument if the string is invalid */
+    [[nodiscard]] std::string_view str(uint32_t off) const;
+    //! Decodes an integrity.
+    /*! \param[in] off an offset of an integrity
+     * \return the cached integrity
+     * \throw std::invalid_argument if the integrity is invalid */
+    const integrity& get_integrity(uint32_t off);
+    //! Decodes a minimum integrity or an inner ACL.
+    /*! \param[in] off an offset of a minimum integrity or an inner ACL, 0 for
+     * an empty one
+     * \return the cached value
+     * \throw std::invalid_argument if the value is invalid */
+    const std::shared_ptr<acl::acl_t>& get_acl(uint32_t off);
+    //! Decodes an ACL.
+    /*! \param[in] off an offset of an ACL
+     * \return the cached ACL
+     * \throw std::invalid_argument if the ACL is invalid */
+    const acl& get_ops_acl(uint32_t off);
+    //! Decodes an integrity function.
+    /*! \param[in] off an offset of a function
+     * \return the cached function
+     * \throw std::invalid_argument if the function is invalid */
+    const integrity_fun& get_fun(uint32_t off);
+    //! Reports an invalid image.
+    /*! \throw std::invalid_argument always */
+    [[noreturn]] static void invalid() {
+        throw std::invalid_argument("Invalid policy image");
+    }
+    mapped_file _file; //!< The mapped image
+    std::span<const unsigned char> _image; //!< The contents of the image
+    uint32_t _entities = 0; //!< The number of entities
+    uint32_t _entity_table = 0; //!< The offset of the entity table
+    std::unordered_map<uint32_t, integrity> _integrity_cache{}; //!< Decoded integrities
+    std::unordered_map<uint32_t, std::shared_ptr<acl::acl_t>> _acl_cache{}; //!< Decoded inner ACLs
+    std::unordered_map<uint32_t, acl> _ops_acl_cache{}; //!< Decoded ACLs
+    std::unordered_map<uint32_t, integrity_fun> _fun_cache{}; //!< Decoded integrity functions
+};
+
+static_assert(soficpp::agent<policy_image>);
+
+class policy_image::builder {
+public:
+    //! Creates an image containing only the header.
+    builder(): image(header_size, 0) {
+        std::ranges::copy(magic, image.begin());
+    }
+    //! Stores a string.
+    /*! \param[in] s a string
+     * \return the offset of \a s */
+    uint32_t string(std::string_view s);
+    //! Stores an integrity.
+    /*! \param[in] i an integrity
+     * \return the offset of \a i */
+    uint32_t integrity(const demo::integrity& i);
+    //! Stores a minimum integrity or an inner ACL.
+    /*! \param[in] a a minimum integrity or an inner ACL
+     * \return the offset of \a a */
+    uint32_t acl(const acl::acl_t& a);
+    //! Stores an ACL.
+    /*! \param[in] a an ACL
+     * \return the offset of \a a */
+    uint32_t ops_acl(const demo::acl& a);
+    //! Stores an integrity function.
+    /*! \param[in] f a function
+     * \return the offset of \a f */
+    uint32_t fun(const integrity_fun& f);
+    //! Stores the entity table and fills the header.
+    /*! \param[in] entities all entities */
+    void entities(const std::vector<entity_t>& entities);
+    sqlite::blob_t image; //!< The contents of the image
+private:
+    //! Appends words.
+    /*! \param[in] words the words
+     * \return the offset of the first word */
+    uint32_t put(std::span<const uint32_t> words);
+    //! Stores a structure, or finds an equal structure stored earlier.
+    /*! \param[in] words the structure
+     * \return the offset of the structure */
+    uint32_t intern(std::vector<uint32_t> words);
+    std::map<std::string, uint32_t, std::less<>> _strings{}; //!< Offsets of strings
+    std::map<std::vector<uint32_t>, uint32_t> _structs{}; //!< Offsets of structures
+};
+
+uint32_t policy_image::builder::put(std::span<const uint32_t> words)
+{
+    size_t off = image.size();
+    if (off + 4 * words.size() > std::numeric_limits<uint32_t>::max())
+        throw std::length_error("Policy image too large");
+    for (uint32_t w: words)
+        for (size_t i = 0; i < 4; ++i)
+            image.push_back(static_cast<unsigned char>(w >> (8 * i)));
+    return uint32_t(off);
+}
+
+uint32_t policy_image::builder::string(std::string_view s)
+{
+    if (auto it = _strings.find(s); it != _strings.end())
+        return it->second;
+    if (s.size() > std::numeric_limits<uint32_t>::max())
+        throw std::length_error("Policy image too large");
+    uint32_t off = put(std::array{uint32_t(s.size())});
+    image.insert(image.end(), s.begin(), s.end());
+    image.resize((image.size() + 3) & ~size_t{3}, 0);
+    if (image.size() > std::numeric_limits<uint32_t>::max())
+        throw std::length_error("Policy image too large");
+    _strings.emplace(s, off);
+    return off;
+}
+
+uint32_t policy_image::builder::intern(std::vector<uint32_t> words)
+{
+    if (auto it = _structs.find(words); it != _structs.end())
+        return it->second;
+    uint32_t off = put(words);
+    _structs.emplace(std::move(words), off);
+    return off;
+}
+
+uint32_t policy_image::builder::integrity(const demo::integrity& i)
+{
+    if (std::holds_alternative<demo::integrity::universe>(i.value()))
+        return intern({universe});
+    auto& elems = std::get<demo::integrity::set_t>(i.value());
+    std::vector<uint32_t> words{uint32_t(elems.size())};
+    for (auto&& e: elems)
+        words.push_back(string(e));
+    return intern(std::move(words));
+}
+
+uint32_t policy_image::builder::acl(const acl::acl_t& a)
+{
+    std::vector<uint32_t> words{uint32_t(a.size())};
+    for (auto&& i: a)
+        words.push_back(integrity(i));
+    return intern(std::move(words));
+}
+
+uint32_t policy_image::builder::ops_acl(const demo::acl& a)
+{
+    std::vector<uint32_t> words{a.default_op ? acl(*a.default_op) : 0, uint32_t(a.size())};
+    for (auto&& o: a) {
+        words.push_back(string(soficpp::enum2sv(o.first)));
+        words.push_back(o.second ? acl(*o.second) : 0);
+    }
+    return intern(std::move(words));
+}
+
+uint32_t policy_image::builder::fun(const integrity_fun& f)
+{
+    std::vector<uint32_t> words{string(f.comment), uint32_t(f.size())};
+    for (auto&& [cmp, plus]: f) {
+        words.push_back(integrity(cmp));
+        words.push_back(plus ? integrity(*plus) : 0);
+    }
+    return intern(std::move(words));
+}
+
+void policy_image::builder::entities(const std::vector<entity_t>& entities)
+{
+    std::vector<const entity_t*> sorted{};
+    for (auto&& e: entities)
+        sorted.push_back(&e);
+    std::ranges::sort(sorted, {}, [](auto&& e) -> const std::string& { return e->name; });
+    std::vector<uint32_t> table{};
+    table.reserve(entity_words * sorted.size());
+    for (auto&& e: sorted)
+        table.insert(table.end(), {
+            string(e->name), integrity(e->integrity()), acl(e->min_integrity()), ops_acl(e->access_ctrl()),
+            fun(e->test_fun()), fun(e->prov_fun()), fun(e->recv_fun()), string(e->data.str())
+        });
+    uint32_t off = put(table);
+    for (size_t i = 0; i < 4; ++i) {
+        image[magic.size() + i] = static_cast<unsigned char>(sorted.size() >> (8 * i));
+        image[magic.size() + 4 + i] = static_cast<unsigned char>(off >> (8 * i));
+    }
+}
+
+policy_image::policy_image(std::string_view file):
+    _file(file_name(file)), _image(_file.data())
+{
+    if (_image.size() < header_size || !std::ranges::equal(_image.first(magic.size()), magic, {}, {},
+                                                           [](char c) { return static_cast<unsigned char>(c); }))
+    {
+        invalid();
+    }
+    _entities = word(magic.size());
+    _entity_table = word(magic.size() + 4);
+    if (_entity_table % 4 != 0 || (_image.size() - _entity_table) / (4 * entity_words) < _entities)
+        invalid();
+}
+
+void policy_image::compile(std::string_view file, const std::vector<entity_t>& entities)
+{
+    builder b{};
+    b.entities(entities);
+    write_file_atomic(file_name(file), b.image);
+}
+
+soficpp::agent_result policy_image::import_msg(const message_t& m, entity_t& e)
+{
+    // Binary search in the entity table sorted by names
+    uint32_t lo = 0;
+    uint32_t hi = _entities;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (str(word(_entity_table + 4 * entity_words * size_t(mid))) < m)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    size_t item = _entity_table + 4 * entity_words * size_t(lo);
+    if (lo == _entities || str(word(item)) != m)
+        return soficpp::agent_result{soficpp::agent_result::error};
+    e.name = m;
+    e.integrity() = get_integrity(word(item + 4));
+    e.min_integrity() = *get_acl(word(item + 8));
+    e.access_ctrl() = get_ops_acl(word(item + 12));
+    e.test_fun() = get_fun(word(item + 16));
+    e.test_fun_name = e.test_fun().comment;
+    e.prov_fun() = get_fun(word(item + 20));
+    e.prov_fun_name = e.prov_fun().comment;
+    e.recv_fun() = get_fun(word(item + 24));
+    e.recv_fun_name = e.recv_fun().comment;
+    e.data = str(word(item + 28));
+    return soficpp::agent_result{soficpp::agent_result::success};
+}
+
+uint32_t policy_image::word(size_t off) const
+{
+    if (off % 4 != 0 || off < header_size - 8 || _image.size() - 4 < off)
+        invalid();
+    uint32_t w = 0;
+    for (size_t i = 0; i < 4; ++i)
+        w |= uint32_t(_image[off + i]) << (8 * i);
+    return w;
+}
+
+std::string_view policy_image::str(uint32_t off) const
+{
+    uint32_t n = word(off);
+    if (_image.size() - off - 4 < n)
+        invalid();
+    return {reinterpret_cast<const char*>(_image.data()) + off + 4, n};
+}
+
+const integrity& policy_image::get_integrity(uint32_t off)
+{
+    if (auto it = _integrity_cache.find(off); it != _integrity_cache.end())
+        return it->second;
+    uint32_t n = word(off);
+    if (n == universe)
+        return _integrity_cache.emplace(off, integrity{integrity::universe{}}).first->second;
+    // Elements are stored sorted, each is allocated once directly from the image
+    auto elems = std::views::iota(size_t{1}, size_t{n} + 1) |
+        std::views::transform([this, off](size_t i) { return str(word(off + 4 * i)); });
+    return _integrity_cache.emplace(off, integrity{integrity::sorted_unique, elems}).first->second;
+}
+
+const std::shared_ptr<acl::acl_t>& policy_image::get_acl(uint32_t off)
+{
+    if (auto it = _acl_cache.find(off); it != _acl_cache.end())
+        return it->second;
+    auto v = std::make_shared<acl::acl_t>();
+    if (off != 0) {
+        uint32_t n = word(off);
+        for (uint32_t i = 1; i <= n; ++i)
+            v->push_back(get_integrity(word(off + 4 * size_t(i))));
+    }
+    return _acl_cache.emplace(off, std::move(v)).first->second;
+}
+
+const acl& policy_image::get_ops_acl(uint32_t off)
+{
+    if (auto it = _ops_acl_cache.find(off); it != _ops_acl_cache.end())
+        return it->second;
+    uint32_t d = word(off);
+    acl v = d != 0 ? acl{get_acl(d)} : acl{};
+    uint32_t n = word(off + 4);
+    for (uint32_t i = 0; i < n; ++i) {
+        size_t item = off + 8 + 8 * size_t(i);
+        auto o = operation::find(str(word(item)));
+        if (!o)
+            invalid();
+        v[o->id()] = get_acl(word(item + 4));
+    }
+    return _ops_acl_cache.emplace(off, std::move(v)).first->second;
+}
+
+const integrity_fun& policy_image::get_fun(uint32_t off)
+{
+    if (auto it = _fun_cache.find(off); it != _fun_cache.end())
+        return it->second;
+    integrity_fun v{};
+    v.comment = str(word(off));
+    uint32_t n = word(off + 4);
+    for (uint32_t i = 0; i < n; ++i) {
+        size_t item = off + 8 + 8 * size_t(i);
+        uint32_t plus = word(item + 4);
+        v.emplace_back(get_integrity(word(item)), plus != 0 ? std::optional{get_integrity(plus)} : std::nullopt);
+    }
+    return _fun_cache.emplace(off, std::move(v)).first->second;
 }
 
 //! The implementation of op_id::no_op
@@ -740,7 +2722,8 @@ protected:
 //! The implementation of op_id::set_integrity
 /*! The new integrity is passed as the argument of the operation in the sane
  * JSON format as used by database view \c integrity_json: it is either the
- * string \c "universe", or a JSON array containing string elements. */
+ * string \c "universe", or a JSON array containing string elements. It is
+ * parsed by integrity_json_parser. */
 class operation_set_integrity: public operation {
 public:
     [[nodiscard]] bool is_write() const override {
@@ -751,37 +2734,12 @@ public:
     }
     //! Parses an integrity from a string.
     /*! \param[in] s an integrity in JSON format
-     * \return the integrity; \c std::nullopt if no database connection has
-     * been attached to this thread by attach_db() or if \a s is invalid */
-    static std::optional<integrity> str2integrity(const std::string& s) {
-        integrity::set_t i{};
-        if (!_db)
-            goto error;
-        for (auto q = std::move(sqlite::query{*_db,
-                                R"(select key, value, type from json_each(?1))"}.start().bind(1, s));
-            q.next_row() == sqlite::query::status::row;)
-        {
-            assert(q.column_count() == 3);
-            auto type = q.get_column(2);
-            if (auto t = std::get_if<std::string>(&type); !t || *t != "text")
-                goto error;
-            auto key = q.get_column(0);
-            auto value = q.get_column(1);
-            if (auto v = std::get_if<std::string>(&value)) {
-                if (auto k = std::get_if<std::nullptr_t>(&key)) {
-                    if (*v != "universe")
-                        goto error;
-                    else
-                        return integrity{integrity::universe{}};
-                } else
-                    i.insert(*v);
-            } else
-                goto error;
-        }
-        return integrity{std::move(i)};
-error:
-        std::cerr << "Invalid integrity JSON value " << s << std::endl;
-        return std::nullopt;
+     * \return the integrity; \c std::nullopt if \a s is invalid */
+    static std::optional<integrity> str2integrity(std::string_view s) {
+        auto i = integrity_json_parser::parse_integrity(s);
+        if (!i)
+            std::cerr << "Invalid integrity JSON value " << s << std::endl;
+        return i;
     }
 protected:
     bool do_exec(entity&, entity& object, const std::string& arg) const override {
@@ -807,29 +2765,12 @@ public:
     }
     //! Parses a minimum integrity from a string.
     /*! \param[in] s a JSON array of integrities
-     * \return the minimum integrity; \c std::nullopt if no database connection
-     * has been attached to this thread by attach_db() or if \a s is invalid */
-    static std::optional<min_integrity> str2min_integrity(const std::string& s) {
-        min_integrity::container_t ic{};
-        if (!_db)
-            goto error;
-        for (auto q = std::move(sqlite::query{*_db, R"(select value from json_each(?1))"}.start().bind(1, s));
-            q.next_row() == sqlite::query::status::row;)
-        {
-            assert(q.column_count() == 1);
-            auto value = q.get_column(0);
-            if (auto v = std::get_if<std::string>(&value)) {
-                if (auto i = operation_set_integrity::str2integrity(*v))
-                    ic.push_back(std::move(*i));
-                else
-                    goto error;
-            } else
-                goto error;
-        }
-        return min_integrity{std::move(ic)};
-error:
-        std::cerr << "Invalid minimum integrity JSON value " << s << std::endl;
-        return std::nullopt;
+     * \return the minimum integrity; \c std::nullopt if \a s is invalid */
+    static std::optional<min_integrity> str2min_integrity(std::string_view s) {
+        auto i = integrity_json_parser::parse_min_integrity(s);
+        if (!i)
+            std::cerr << "Invalid minimum integrity JSON value " << s << std::endl;
+        return i;
     }
 protected:
     bool do_exec(entity&, entity& object, const std::string& arg) const override {
@@ -848,18 +2789,8 @@ public:
         return op_id::clone;
     }
 protected:
-    bool do_exec(entity&, entity& object, const std::string& arg) const override {
-        if (!_db)
-            return false;
-        entity cloned = object;
-        cloned.name = arg;
-        agent a{*_db};
-        std::string exported_clone;
-        if (!a.export_msg(cloned, exported_clone)) {
-            std::cerr << "Cannot export cloned object \"" << cloned.name << "\"" << std::endl;
-            return EXIT_FAILURE;
-        }
-        assert(cloned.name == exported_clone);
+    bool do_exec(entity&, entity&, const std::string&) const override {
+        clone_object();
         return true;
     }
 };
@@ -877,35 +2808,94 @@ protected:
     }
 };
 
+//! The registry of all operations
+class operation::registry {
+public:
+    //! Gets the single registry.
+    /*! \return the registry, created by the first call */
+    static const registry& get() {
+        static const registry r{};
+        return r;
+    }
+    //! Finds an operation by its name.
+    /*! \param[in] name the name of an operation
+     * \return the operation object, \c nullptr if not found */
+    [[nodiscard]] const operation* find(std::string_view name) const noexcept {
+        const operation* op = names[hash(name, seed) % names.size()];
+        return op && op->name() == name ? op : nullptr;
+    }
+    ops_map_t ops{}; //!< Operations indexed by op_id
+private:
+    //! Registers all operations and creates the name table.
+    registry() {
+        add(std::make_unique<operation_no_op>());
+        add(std::make_unique<operation_read>());
+        add(std::make_unique<operation_write>());
+        add(std::make_unique<operation_read_append>());
+        add(std::make_unique<operation_write_append>());
+        add(std::make_unique<operation_write_arg>());
+        add(std::make_unique<operation_append_arg>());
+        add(std::make_unique<operation_swap>());
+        add(std::make_unique<operation_set_integrity>());
+        add(std::make_unique<operation_set_min_integrity>());
+        add(std::make_unique<operation_clone>());
+        add(std::make_unique<operation_destroy>());
+        // Search for a seed that maps all names to different slots
+        for (;; ++seed) {
+            names.fill(nullptr);
+            if (std::ranges::all_of(ops, [this](auto&& op) {
+                    auto& slot = names[hash(op->name(), seed) % names.size()];
+                    return !std::exchange(slot, op.get());
+                }))
+            {
+                break;
+            }
+        }
+    }
+    //! Registers an operation.
+    /*! \param[in] op the operation */
+    void add(std::unique_ptr<operation> op) {
+        auto i = static_cast<size_t>(op->id());
+        assert(i < ops.size() && !ops[i]);
+        op->_name = soficpp::enum2sv(op->id());
+        ops[i] = std::move(op);
+    }
+    //! Computes a seeded hash of a name.
+    /*! \param[in] name a name
+     * \param[in] seed a seed
+     * \return the 32-bit FNV-1a hash of \a name, starting from a value
+     * modified by \a seed */
+    static uint32_t hash(std::string_view name, uint32_t seed) noexcept {
+        uint32_t h = 0x811c9dc5U ^ seed;
+        for (char c: name) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 0x01000193U;
+        }
+        return h;
+    }
+    //! The perfect hash table of operations indexed by hashes of names
+    std::array<const operation*, 4 * count> names{};
+    uint32_t seed = 0; //!< The seed of hash() that makes \ref names a perfect hash table
+};
+
 auto operation::get() -> const ops_map_t&
 {
-    static auto ops_map = []() {
-        std::map<op_id, std::unique_ptr<operation>> ops;
-        ops[op_id::no_op] = std::make_unique<operation_no_op>();
-        ops[op_id::read] = std::make_unique<operation_read>();
-        ops[op_id::write] = std::make_unique<operation_write>();
-        ops[op_id::read_append] = std::make_unique<operation_read_append>();
-        ops[op_id::write_append] = std::make_unique<operation_write_append>();
-        ops[op_id::write_arg] = std::make_unique<operation_write_arg>();
-        ops[op_id::append_arg] = std::make_unique<operation_append_arg>();
-        ops[op_id::swap] = std::make_unique<operation_swap>();
-        ops[op_id::set_integrity] = std::make_unique<operation_set_integrity>();
-        ops[op_id::set_min_integrity] = std::make_unique<operation_set_min_integrity>();
-        ops[op_id::clone] = std::make_unique<operation_clone>();
-        ops[op_id::destroy] = std::make_unique<operation_destroy>();
-        return ops;
-    }();
-    return ops_map;
+    return registry::get().ops;
 }
 
 const operation& operation::get(op_id id)
 {
     auto& ops = get();
-    if (auto it = ops.find(id); it != ops.end() && it->second)
-        return *it->second;
+    if (auto i = static_cast<size_t>(id); i < ops.size() && ops[i])
+        return *ops[i];
     throw std::invalid_argument("Unknown operation id " + soficpp::enum2str(id));
 }
 
+const operation* operation::find(std::string_view name) noexcept
+{
+    return registry::get().find(name);
+}
+
 //! The engine class
 using engine = soficpp::engine<entity>;
 
@@ -930,33 +2920,167 @@ struct op_record {
     bool destroy = false; //!< Result: whether the operation destroyed the object
 };
 
+//! Storage of entities used by cmd_run()
+enum class storage {
+    database, //!< Table \c entity of the database, possibly partitioned into shards
+    log, //!< A demo::log_agent
+};
+
+//! Gets the database file name of a shard.
+/*! \param[in] file the database file name of shard 0
+ * \param[in] k a shard index
+ * \return \a file for shard 0, <tt><em>file</em>.<em>k</em></tt> for other
+ * shards */
+std::string shard_file(std::string_view file, size_t k)
+{
+    std::string f{file};
+    if (k > 0)
+        f.append(".").append(std::to_string(k));
+    return f;
+}
+
+//! Selects the shard of an entity.
+/*! \param[in] name an entity name
+ * \param[in] n the number of shards
+ * \return the index of the shard storing entity \a name */
+size_t shard_of(std::string_view name, size_t n)
+{
+    return demo::fnv1a(name) % n;
+}
+
+//! Gets the number of shards.
+/*! \param[in] db a connection to shard 0
+ * \return the number of shards stored in table \c shards
+ * \throw std::runtime_error if the number of shards is not set or if entities
+ * are being moved among shards by an unfinished cmd_reshard() */
+size_t shard_count(sqlite::connection& db)
+{
+    sqlite::query q{db, R"(select n, target from shards)"};
+    if (q.start().next_row() != sqlite::query::status::row)
+        throw std::runtime_error("Missing number of shards in table SHARDS");
+    if (q.get_column_type(1) != sqlite::query::column_type::ct_null)
+        throw std::runtime_error("Resharding to " + std::to_string(q.get<int64_t>(1)) +
+                                 " shards has not finished, execute command \"reshard\" again");
+    return size_t(q.get<int64_t>(0));
+}
+
+//! Checks that there are no entities pending to be written to shards.
+/*! Entities are left pending in table \c shard_pending if a run is
+ * interrupted after committing a batch of operations. They are written to
+ * their shards by the next run.
+ * \param[in] db a connection to shard 0
+ * \return \c true if there are no pending entities; otherwise, an error
+ * message is displayed */
+bool no_shard_pending(sqlite::connection& db)
+{
+    sqlite::query q{db, R"(select count() from shard_pending)"};
+    q.start().next_row();
+    if (q.get<int64_t>(0) > 0) {
+        std::cerr << "Entities of an interrupted run are pending, execute command \"run\" first" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//! Checks that entities are not stored in a log.
+/*! While entities are stored by a demo::log_agent, table \c entity is
+ * outdated. A command using it would work with outdated entities and command
+ * \c checkpoint would overwrite its changes later.
+ * \param[in] file the database file name
+ * \return \c true if entities are not stored in a log; otherwise, an error
+ * message is displayed */
+bool no_log_storage(std::string_view file)
+{
+    if (demo::log_agent::exists(file)) {
+        std::cerr << "Entities are stored in a log, use \"-b log\" or execute command \"checkpoint\" first" <<
+            std::endl;
+        return false;
+    }
+    return true;
+}
+
 //! Displays a short help
 /*! \param[in] argv0 argument \c argv[0] from main()
  * \param[in] msg an error message
  * \return program exit code (indicates a failure) */
 int usage(const char* argv0, std::string_view msg)
 {
-    std::cerr << msg << "\n\nusage:\n\n" << argv0 << R"( init FILE
+    std::cerr << msg << "\n\nusage:\n\n" << argv0 << R"( [-p PRESET] init FILE
     Initializes a new database FILE.
 
-)" << argv0 << R"( run FILE
-    Executes SOFI operations in database FILE.
-)";
+)" << argv0 << R"( [-p PRESET] [-j JOBS] [-b STORAGE] run FILE
+    Executes SOFI operations in database FILE.
+
+)" << argv0 << R"( [-p PRESET] [-j JOBS] [-b STORAGE] serve FILE
+    Executes SOFI operations in database FILE, waiting for new operations until
+    terminated by SIGINT or SIGTERM.
+
+)" << argv0 << R"( [-p PRESET] gc FILE
+    Deletes unreferenced integrities, ACLs, and functions from database FILE.
+
+)" << argv0 << R"( [-p PRESET] [-s SHARDS] reshard FILE
+    Partitions entities of database FILE into SHARDS files FILE, FILE.1, ...,
+    by hashes of entity names, default 1. Commands run, serve, and gc use all
+    shards of FILE.
+
+)" << argv0 << R"( [-p PRESET] checkpoint FILE
+    Stores entities from files FILE.snap and FILE.log, created by "-b log", in
+    database FILE and deletes the files.
+
+)" << argv0 << R"( [-p PRESET] compile FILE
+    Writes all entities of database FILE to a read-only policy image
+    FILE.policy.
+
+)" << argv0 << R"( [-p PRESET] check FILE
+    Evaluates verdicts of operations requested in database FILE using entities
+    from FILE.policy, created by command compile, without executing the
+    operations.
+
+-b STORAGE
+    Selects the storage of entities, "database" (default) or "log". The log
+    storage keeps entities in memory and persists them in an append-only log
+    FILE.log and a snapshot FILE.snap, which are initialized from database
+    FILE when used for the first time. Until command checkpoint, commands run,
+    serve, gc, and reshard with the database storage refuse to run.
+
+-j JOBS
+    Prepares up to JOBS operations with disjoint entities in parallel, default 1.
+    Results are the same as of sequential execution, provided that no other
+    program modifies entities concurrently.
+
+-p PRESET
+    Selects named connection options, one of:)";
+    for (auto&& n: sqlite::connection::options::preset_names())
+        std::cerr << ' ' << n;
+    std::cerr << std::endl;
     return EXIT_FAILURE;
 }
 
 //! Initializes the database
 /*! \param[in] file the database file name
+ * \param[in] opts connection options
  * \return program exit code */
-int cmd_init(std::string_view file)
+int cmd_init(std::string_view file, const sqlite::connection::options& opts)
 {
-    sqlite::connection db{std::string{file}, true};
+    sqlite::connection db{std::string{file}, true, opts};
     // Set WAL mode (persistent)
     sqlite::query(db, R"(pragma journal_mode=wal)").start().next_row();
     // Check foreign key constrains, must be set for every connection outside of transactions
     sqlite::query(db, R"(pragma foreign_keys=true)").start().next_row();
     sqlite::transaction tr{db};
     for (const auto& sql: {
+        // Sequences of IDs used by tables INTEGRITY_ID, ACL_ID, INT_FUN_ID,
+        // and REQUEST. NEXT is the next free ID of a sequence. Insertable
+        // views allocate IDs from the sequences. A program may reserve a block
+        // of IDs by incrementing NEXT and then use these IDs without accessing
+        // the sequence. Triggers keep NEXT greater than any ID inserted by
+        // other means.
+        R"(create table sequence (
+                name text primary key,
+                next int not null,
+                constraint sequence_next_not_negative check (next >= 0)
+            ) without rowid, strict)",
+        R"(insert into sequence values ('integrity_id', 0), ('acl_id', 0), ('int_fun_id', 0), ('request', 0))",
         // Stores IDs of integrity values. This table is needed in order to use
         // integrity IDs as a foreign key, because a foreign key must be the
         // primary key or have a unique index. If UNIVERSE is TRUE, then
@@ -967,13 +3091,19 @@ int cmd_init(std::string_view file)
                 constraint integrity_id_not_negative check (id >= 0),
                 constraint universe_bool check (universe == false or universe == true)
             ))",
+        R"(create trigger integrity_id_sequence after insert on integrity_id
+            when new.id >= (select next from sequence where name == 'integrity_id')
+            begin
+                update sequence set next = new.id + 1 where name == 'integrity_id';
+            end)",
         // Insertable view returning the maximum ID from INTEGRITY_ID. Inserting
         // into this view inserts into INTEGRITY_ID, inserting NULL generates a
-        // new integrity ID
+        // new integrity ID from the sequence
         R"(create view integrity_id_max(id, universe) as select max(id), null from integrity_id)",
         R"(create trigger integrity_id_max_insert instead of insert on integrity_id_max
             begin
-                insert into integrity_id select coalesce(new.id, id + 1, 0), new.universe from integrity_id_max;
+                insert into integrity_id
+                    select coalesce(new.id, next), new.universe from sequence where name == 'integrity_id';
             end)",
         // Table of integrity values. Rows with the same ID define a single
         // integrity. If there is no row in INTEGRITY for an ID from
@@ -1033,14 +3163,21 @@ int cmd_init(std::string_view file)
                 id integer primary key,
                 constraint acl_id_not_negative check (id >= 0)
             ))",
+        R"(create trigger acl_id_sequence after insert on acl_id
+            when new.id >= (select next from sequence where name == 'acl_id')
+            begin
+                update sequence set next = new.id + 1 where name == 'acl_id';
+            end)",
         // Insertable view returning the maximum ID from ACL_ID. Inserting into
         // this view inserts into ACL_ID, inserting NULL generates a new ACL
-        // ID, inserting an existing ID does nothing
-        // "WHERE true" removes a parsing ambiguity reported as a syntax error
+        // ID from the sequence, inserting an existing ID does nothing
+        // The WHERE clause removes a parsing ambiguity reported as a syntax error
         R"(create view acl_id_max(id) as select max(id) from acl_id)",
         R"(create trigger acl_id_max_insert instead of insert on acl_id_max
             begin
-                insert into acl_id select coalesce(new.id, id + 1, 0) from acl_id_max where true on conflict do nothing;
+                insert into acl_id
+                    select coalesce(new.id, next) from sequence where name == 'acl_id'
+                    on conflict do nothing;
             end)",
         // Table of ACLs. Rows with the same ID define a single ACL with
         // semantics of soficpp::ops_acl containing soficpp::acl. That is,
@@ -1132,15 +3269,20 @@ int cmd_init(std::string_view file)
                 comment text default '',
                 constraint int_fun_id_not_negative check (id >= 0)
             ))",
+        R"(create trigger int_fun_id_sequence after insert on int_fun_id
+            when new.id >= (select next from sequence where name == 'int_fun_id')
+            begin
+                update sequence set next = new.id + 1 where name == 'int_fun_id';
+            end)",
         // Insertable view returning the maximum ID from INT_FUN_ID. Inserting
         // into this view inserts into INT_FUN_ID, inserting ID=NULL generates
-        // a new function ID.
+        // a new function ID from the sequence.
         R"(create view int_fun_id_max(id, comment) as select max(id), null from int_fun_id)",
         R"(create trigger int_fun_id_max_insert instead of insert on int_fun_id_max
             begin
                 insert into int_fun_id
-                    select coalesce(new.id, id + 1, 0), new.comment
-                    from int_fun_id_max where true on conflict do nothing;
+                    select coalesce(new.id, next), new.comment
+                    from sequence where name == 'int_fun_id' on conflict do nothing;
             end)",
         // Table of integrity modification functions, usable as test, providing,
         // and receiving functions of entities. Each function is a set of pairs
@@ -1192,7 +3334,34 @@ int cmd_init(std::string_view file)
         // Insert a minimum integrity, identity, and maximum integrity functions
         R"(insert into int_fun_json values
             (null, '[]', '[]', 'min'), (null, '[]', null, 'identity'), (null, '[]', '"universe"', 'max'))",
+        // Content-addressed indices of integrities, ACLs, and integrity
+        // functions exported by demo::agent. CONTENT is a canonical form of a
+        // value (integrities are in the JSON format of INTEGRITY_JSON, ACLs
+        // and functions refer to IDs of their integrities), HASH is a hash of
+        // CONTENT. An ID present in an index is reused for any equal value
+        // exported later, hence the value with the ID must not be modified.
+        // Unreferenced values with IDs present in these indices are deleted
+        // by command "gc".
+        R"(create table integrity_hash (
+                id integer primary key references integrity_id(id) on delete cascade on update cascade,
+                hash int not null,
+                content text not null
+            ) strict)",
+        R"(create index integrity_hash_idx_hash on integrity_hash (hash))",
+        R"(create table acl_hash (
+                id integer primary key references acl_id(id) on delete cascade on update cascade,
+                hash int not null,
+                content text not null
+            ) strict)",
+        R"(create index acl_hash_idx_hash on acl_hash (hash))",
+        R"(create table int_fun_hash (
+                id integer primary key references int_fun_id(id) on delete cascade on update cascade,
+                hash int not null,
+                content text not null
+            ) strict)",
+        R"(create index int_fun_hash_idx_hash on int_fun_hash (hash))",
         // Table of entities. DATA can be used (read and written) by implementations
+        // of operations.
         R"(create table entity (
                 name text primary key,
                 integrity int not null references integrity_id(id) on delete restrict on update restrict,
@@ -1209,6 +3378,103 @@ int cmd_init(std::string_view file)
         R"(create index entity_idx_test_fun on entity (test_fun))",
         R"(create index entity_idx_prov_fun on entity (prov_fun))",
         R"(create index entity_idx_recv_fun on entity (recv_fun))",
+        // POLICY caches the integrity, the minimum integrity, the ACL, and the
+        // integrity functions of an entity in a binary form. It is maintained
+        // by program sofi_demo. A policy is deleted if its entity is inserted,
+        // deleted, or any of the referencing columns is changed, and if any of
+        // the referenced rows of the normalized tables is changed, so that the
+        // entity is imported from the normalized tables. Triggers delete
+        // policies also if foreign keys are not enforced by a connection.
+        R"(create table entity_policy (
+                name text primary key references entity(name) on delete cascade on update cascade,
+                policy blob not null
+            ) without rowid, strict)",
+        R"(create trigger entity_policy_ins after insert on entity
+            begin
+                delete from entity_policy where name == new.name;
+            end)",
+        R"(create trigger entity_policy_del after delete on entity
+            begin
+                delete from entity_policy where name == old.name;
+            end)",
+        R"(create trigger entity_policy_upd
+            after update of name, integrity, min_integrity, acl, test_fun, prov_fun, recv_fun on entity
+            begin
+                delete from entity_policy where name in (old.name, new.name);
+            end)",
+        // Names of entities depending on an ACL
+        R"(create view policy_dep_acl(id, name) as
+            select min_integrity, name from entity
+            union all select acl, name from entity)",
+        // Names of entities depending on an integrity function
+        R"(create view policy_dep_int_fun(id, name) as
+            select test_fun, name from entity
+            union all select prov_fun, name from entity
+            union all select recv_fun, name from entity)",
+        // Names of entities depending on an integrity, directly or via an ACL
+        // or an integrity function
+        R"(create view policy_dep_integrity(id, name) as
+            select integrity, name from entity
+            union all select a.integrity, e.name from acl as a join entity as e on e.min_integrity == a.id
+            union all select a.integrity, e.name from acl as a join entity as e on e.acl == a.id
+            union all select f.cmp, e.name from int_fun as f join entity as e on e.test_fun == f.id
+            union all select f.cmp, e.name from int_fun as f join entity as e on e.prov_fun == f.id
+            union all select f.cmp, e.name from int_fun as f join entity as e on e.recv_fun == f.id
+            union all select f.plus, e.name from int_fun as f join entity as e on e.test_fun == f.id
+            union all select f.plus, e.name from int_fun as f join entity as e on e.prov_fun == f.id
+            union all select f.plus, e.name from int_fun as f join entity as e on e.recv_fun == f.id)",
+        R"(create trigger integrity_ins_policy after insert on integrity
+            begin
+                delete from entity_policy where name in (select name from policy_dep_integrity where id == new.id);
+            end)",
+        R"(create trigger integrity_upd_policy after update on integrity
+            begin
+                delete from entity_policy
+                    where name in (select name from policy_dep_integrity where id in (old.id, new.id));
+            end)",
+        R"(create trigger integrity_del_policy after delete on integrity
+            begin
+                delete from entity_policy where name in (select name from policy_dep_integrity where id == old.id);
+            end)",
+        R"(create trigger integrity_id_upd_policy after update on integrity_id
+            begin
+                delete from entity_policy
+                    where name in (select name from policy_dep_integrity where id in (old.id, new.id));
+            end)",
+        R"(create trigger acl_ins_policy after insert on acl
+            begin
+                delete from entity_policy where name in (select name from policy_dep_acl where id == new.id);
+            end)",
+        R"(create trigger acl_upd_policy after update on acl
+            begin
+                delete from entity_policy where name in (select name from policy_dep_acl where id in (old.id, new.id));
+            end)",
+        R"(create trigger acl_del_policy after delete on acl
+            begin
+                delete from entity_policy where name in (select name from policy_dep_acl where id == old.id);
+            end)",
+        R"(create trigger acl_id_upd_policy after update on acl_id
+            begin
+                delete from entity_policy where name in (select name from policy_dep_acl where id in (old.id, new.id));
+            end)",
+        R"(create trigger int_fun_ins_policy after insert on int_fun
+            begin
+                delete from entity_policy where name in (select name from policy_dep_int_fun where id == new.id);
+            end)",
+        R"(create trigger int_fun_upd_policy after update on int_fun
+            begin
+                delete from entity_policy
+                    where name in (select name from policy_dep_int_fun where id in (old.id, new.id));
+            end)",
+        R"(create trigger int_fun_del_policy after delete on int_fun
+            begin
+                delete from entity_policy where name in (select name from policy_dep_int_fun where id == old.id);
+            end)",
+        R"(create trigger int_fun_id_upd_policy after update on int_fun_id
+            begin
+                delete from entity_policy
+                    where name in (select name from policy_dep_int_fun where id in (old.id, new.id));
+            end)",
         // View of entities with some JSON values
         R"(create view entity_json as
             select
@@ -1237,13 +3503,20 @@ int cmd_init(std::string_view file)
                 comment text default ''
             ) strict)",
         R"(create index request_idx_op on request (op))",
-        // Insertable view of table REQUEST that automatically allocates the next ID
+        R"(create trigger request_sequence after insert on request
+            when new.id >= (select next from sequence where name == 'request')
+            begin
+                update sequence set next = new.id + 1 where name == 'request';
+            end)",
+        // Insertable view of table REQUEST that automatically allocates the
+        // next ID from the sequence. IDs are not reused after executed
+        // requests are deleted from REQUEST.
         R"(create view request_ins(subject, object, op, arg, comment) as
             select subject, object, op, arg, comment from request order by id)",
         R"(create trigger request_ins_insert instead of insert on request_ins
             begin
                 insert into request values (
-                    (select coalesce(max(id) + 1, 0) from request),
+                    (select next from sequence where name == 'request'),
                     new.subject, new.object, new.op, new.arg, new.comment);
             end)",
         // Table of operation results. Completed operations are moved from
@@ -1269,136 +3542,1136 @@ int cmd_init(std::string_view file)
                 constraint error_bool check (error == false or error == true)
             ) strict)",
         R"(create index result_idx_op on result (op))",
+        // The number of shards. Entities are partitioned by hashes of their
+        // names into this database (shard 0) and databases FILE.1, ...,
+        // FILE.<N-1>, where FILE is the name of this database. Entities are
+        // moved among shards by command "reshard". Tables REQUEST and RESULT
+        // are used only in shard 0. TARGET is the number of shards set by an
+        // unfinished "reshard", other commands refuse to run if it is not
+        // NULL.
+        R"(create table shards (
+                n int not null,
+                target int default null,
+                constraint shards_positive check (n > 0),
+                constraint shards_target_positive check (target > 0)
+            ) strict)",
+        R"(insert into shards values (1, null))",
+        // Entities modified by committed operations, but not yet written to
+        // their shards. They are stored in the same transaction as results of
+        // the operations and deleted after being written to the shards. A
+        // NULL POLICY denotes a destroyed entity.
+        R"(create table shard_pending (
+                name text primary key,
+                policy blob default null,
+                data text default null
+            ) without rowid, strict)",
     }) {
         sqlite::query(db, sql).start().next_row();
     }
     // Insert all known operations to table OPERATION
-    for (auto&& [k, v]: demo::operation::get()) {
-        sqlite::query{db, R"(insert into operation values (?1, ?2, ?3))"}.start().
-            bind(1, soficpp::enum2str(k)).bind(2, v->is_read()).bind(3, v->is_write()).
-            next_row();
+    for (auto&& v: demo::operation::get()) {
+        db.cached(R"(insert into operation values (?1, ?2, ?3))")->start().
+            bind_all(v->name(), v->is_read(), v->is_write()).next_row();
     }
     tr.commit();
     return EXIT_SUCCESS;
 }
 
-//! Gets all operation requests from the database.
-/*! \param[in] db a database connection
- * \return the operation requests */
-std::deque<op_record> get_op_requests(sqlite::connection& db)
+//! Deletes unreferenced values from the database
+/*! Only values with IDs present in content-addressed indices \c
+ * integrity_hash, \c acl_hash, and \c int_fun_hash are deleted. Other values
+ * have been inserted by other means than demo::agent, and they are kept,
+ * because they can be referenced by entities inserted later. If the database
+ * is partitioned into shards, each shard is processed separately. It fails if
+ * entities of an interrupted run are pending to be written to shards, or if
+ * entities are stored in a demo::log_agent.
+ * \param[in] file the database file name
+ * \param[in] opts connection options
+ * \return program exit code */
+int cmd_gc(std::string_view file, const sqlite::connection::options& opts)
+{
+    if (!no_log_storage(file))
+        return EXIT_FAILURE;
+    size_t shards = 1;
+    for (size_t k = 0; k < shards; ++k) {
+        sqlite::connection db{shard_file(file, k), false, opts};
+        if (k == 0) {
+            shards = shard_count(db);
+            if (!no_shard_pending(db))
+                return EXIT_FAILURE;
+        }
+        if (shards > 1)
+            std::cout << "Shard " << k << std::endl;
+        // Check foreign key constrains, must be set for every connection outside of transactions.
+        // It also enables cascade deletes from INTEGRITY, ACL, INT_FUN, and content-addressed indices.
+        sqlite::query(db, R"(pragma foreign_keys=1)").start().next_row();
+        sqlite::transaction tr{db};
+        // Functions and ACLs must be deleted first, because they reference integrities
+        for (const auto& [name, sql]: std::initializer_list<std::pair<std::string_view, std::string_view>>{
+            {"integrity functions", R"(
+                delete from int_fun_id
+                where
+                    id in (select id from int_fun_hash) and
+                    id not in (
+                        select test_fun from entity union select prov_fun from entity union select recv_fun from entity)
+                returning id)"},
+            {"ACLs", R"(
+                delete from acl_id
+                where
+                    id in (select id from acl_hash) and
+                    id not in (select min_integrity from entity union select acl from entity)
+                returning id)"},
+            {"integrities", R"(
+                delete from integrity_id
+                where
+                    id in (select id from integrity_hash) and
+                    id not in (
+                        select integrity from entity union
+                        select integrity from acl where integrity is not null union
+                        select cmp from int_fun union
+                        select plus from int_fun where plus is not null)
+                returning id)"},
+        }) {
+            sqlite::query q{db, std::string{sql}};
+            size_t n = 0;
+            for (q.start(); q.next_row() == sqlite::query::status::row;)
+                ++n;
+            std::cout << "Deleted " << name << ": " << n << std::endl;
+        }
+        tr.commit();
+    }
+    return EXIT_SUCCESS;
+}
+
+//! Moves entities to their shards
+/*! It sets the number of shards to \a n. Each entity stored in shard 0 or in
+ * any existing file shard_file() is moved to the shard selected by
+ * shard_of(). Missing shard files are created. Existing shard files with
+ * indices not less than \a n are kept, but they contain no entities
+ * afterwards. An entity is deleted from its old shard after it has been
+ * committed to its new shard, therefore, the command can be executed again if
+ * it fails. The new number of shards is recorded as column \c target of table
+ * \c shards before any entity is moved and it replaces the number of shards
+ * after all entities have been moved. Until then, other commands refuse to use
+ * the database, because entities may be stored in shards other than those
+ * selected by the old or the new number of shards. It fails if entities are
+ * stored in a demo::log_agent.
+ * \param[in] file the database file name of shard 0
+ * \param[in] opts connection options
+ * \param[in] n the number of shards
+ * \return program exit code */
+int cmd_reshard(std::string_view file, const sqlite::connection::options& opts, size_t n)
 {
-    std::deque<op_record> ops;
-    for (auto q = std::move(sqlite::query{db,
-                            R"(select id, subject, object, op, arg, comment from request order by id)"}.start());
-         q.next_row() == sqlite::query::status::row;)
+    if (!no_log_storage(file))
+        return EXIT_FAILURE;
+    sqlite::pool main{std::string{file}, opts};
+    sqlite::connection& db = main.writer();
+    if (!no_shard_pending(db))
+        return EXIT_FAILURE;
+    // Shard files left by an interrupted reshard may contain entities
+    size_t files = n;
     {
-        assert(q.column_count() == 6);
-        op_record op{};
-        auto get_val = [&q]<class T>(int i, T& v, bool null = false) {
-            auto c = q.get_column(i);
-            if (null && std::get_if<std::nullptr_t>(&c))
-                return;
-            if (auto p = std::get_if<T>(&c))
-                v = *p;
-            else
-                throw std::runtime_error("Unexpected type of table REQUEST column " + std::to_string(i));
-        };
-        get_val(0, op.id);
-        get_val(1, op.subject);
-        get_val(2, op.object);
-        std::string op_op;
-        get_val(3, op_op);
-        try {
-            op.op = &demo::operation::get(soficpp::str2enum<demo::op_id>(op_op));
-        } catch (const std::invalid_argument&) {
-            throw std::runtime_error("Unknown operation name \"" + op_op + "\" in table REQUEST");
+        sqlite::query q{db, R"(select max(n, coalesce(target, n)) from shards)"};
+        if (q.start().next_row() != sqlite::query::status::row)
+            throw std::runtime_error("Missing number of shards in table SHARDS");
+        files = std::max(files, size_t(q.get<int64_t>(0)));
+    }
+    sqlite::query(db, R"(update shards set target = ?1)").start().bind(1, int64_t(n)).next_row();
+    while (std::filesystem::exists(shard_file(file, files)))
+        ++files;
+    for (size_t k = 1; k < n; ++k)
+        if (auto f = shard_file(file, k); !std::filesystem::exists(f))
+            if (int status = cmd_init(f, opts); status != EXIT_SUCCESS)
+                return status;
+    std::vector<std::unique_ptr<sqlite::pool>> pools{};
+    std::vector<std::unique_ptr<demo::agent>> agents{};
+    for (size_t k = 0; k < files; ++k) {
+        sqlite::pool& p =
+            k == 0 ? main : *pools.emplace_back(std::make_unique<sqlite::pool>(shard_file(file, k), opts));
+        // Check foreign key constrains, must be set for every connection outside of transactions
+        sqlite::query(p.writer(), R"(pragma foreign_keys=1)").start().next_row();
+        agents.push_back(std::make_unique<demo::agent>(p.writer(), p.reader()));
+    }
+    auto writer = [&](size_t k) -> sqlite::connection& {
+        return k == 0 ? db : pools[k - 1]->writer();
+    };
+    for (size_t k = 0; k < files; ++k) {
+        std::vector<std::string> names{};
+        {
+            sqlite::query q{writer(k), R"(select name from entity)"};
+            q.start();
+            for (auto&& [name]: q.rows<std::string>())
+                if (shard_of(name, n) != k)
+                    names.push_back(std::move(name));
+        }
+        if (names.empty())
+            continue;
+        std::vector<demo::entity> moved{};
+        if (!agents[k]->import_msgs(names, moved)) {
+            std::cerr << "Cannot import entities from shard " << k << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::vector<std::vector<const demo::entity*>> by_shard(n);
+        for (auto&& e: moved)
+            by_shard[shard_of(e.name, n)].push_back(&e);
+        for (size_t d = 0; d < n; ++d) {
+            if (by_shard[d].empty())
+                continue;
+            bool retried = false;
+            sqlite::retry_transaction(writer(d), [&](sqlite::transaction&) {
+                if (retried)
+                    agents[d]->reset();
+                retried = true;
+                for (auto&& e: by_shard[d]) {
+                    std::string exported{};
+                    if (!agents[d]->export_msg(*e, exported))
+                        throw std::runtime_error("Cannot export entity \"" + e->name + "\" to shard " +
+                                                 std::to_string(d));
+                }
+            });
+        }
+        sqlite::retry_transaction(writer(k), [&](sqlite::transaction&) {
+            auto del = writer(k).cached(R"(delete from entity where name = ?1)");
+            for (auto&& name: names)
+                del->start().bind(1, name).next_row();
+        });
+        std::cout << "Moved entities from shard " << k << ": " << names.size() << std::endl;
+    }
+    sqlite::query(db, R"(update shards set n = target, target = null)").start().next_row();
+    return EXIT_SUCCESS;
+}
+
+//! Creates a predicate telling if a request has been committed
+/*! It is used by demo::log_agent to select batches of its log that have been
+ * committed to the database.
+ * \param[in] db a database connection
+ * \return a predicate that returns \c true if a request ID is not in table \c
+ * request */
+demo::log_agent::committed_t committed_request(sqlite::connection& db)
+{
+    return [&db](int64_t id) {
+        auto q = db.cached(R"(select not exists (select * from request where id = ?1))");
+        q->start().bind(1, id).next_row();
+        bool result = q->get<int64_t>(0) != 0;
+        q->start();
+        return result;
+    };
+}
+
+//! Moves entities from a demo::log_agent to the database
+/*! Table \c entity is replaced by the entities stored by the log_agent, then
+ * the snapshot and the log of the log_agent are deleted. Therefore, the next
+ * <tt>sofi_demo -b log run</tt> initializes the log_agent from table \c
+ * entity again. If the command fails, it can be executed again.
+ * \param[in] file the database file name
+ * \param[in] opts connection options
+ * \return program exit code */
+int cmd_checkpoint(std::string_view file, const sqlite::connection::options& opts)
+{
+    if (!demo::log_agent::exists(file)) {
+        std::cout << "Entities are not stored in a log" << std::endl;
+        return EXIT_SUCCESS;
+    }
+    sqlite::connection db{std::string{file}, false, opts};
+    // Check foreign key constrains, must be set for every connection outside of transactions
+    sqlite::query(db, R"(pragma foreign_keys=1)").start().next_row();
+    {
+        demo::log_agent log{file, committed_request(db)};
+        demo::agent agent{db};
+        bool retried = false;
+        sqlite::retry_transaction(db, [&](sqlite::transaction&) {
+            if (retried)
+                agent.reset();
+            retried = true;
+            std::vector<std::string> deleted{};
+            {
+                sqlite::query q{db, R"(select name from entity)"};
+                q.start();
+                for (auto&& [name]: q.rows<std::string>())
+                    if (!log.entities().contains(name))
+                        deleted.push_back(std::move(name));
+            }
+            auto del = db.cached(R"(delete from entity where name = ?1)");
+            for (auto&& name: deleted)
+                del->start().bind(1, name).next_row();
+            for (auto&& e: log.entities()) {
+                std::string exported{};
+                if (!agent.export_msg(e.second, exported))
+                    throw std::runtime_error("Cannot export entity \"" + e.first + "\"");
+            }
+        });
+        std::cout << "Stored entities: " << log.entities().size() << std::endl;
+    }
+    demo::log_agent::remove(file);
+    return EXIT_SUCCESS;
+}
+
+//! Compiles entities to a demo::policy_image
+/*! It reads all entities, from all shards of the database, or from the
+ * demo::log_agent if entities are stored in a log, and writes them to the
+ * image file. The database is not modified. It fails if entities of an
+ * interrupted run are pending to be written to shards.
+ * \param[in] file the database file name
+ * \param[in] opts connection options
+ * \return program exit code */
+int cmd_compile(std::string_view file, const sqlite::connection::options& opts)
+{
+    std::vector<demo::entity> entities{};
+    sqlite::connection db{std::string{file}, false, opts};
+    if (demo::log_agent::exists(file)) {
+        demo::log_agent log{file, committed_request(db)};
+        for (auto&& e: log.entities())
+            entities.push_back(e.second);
+    } else {
+        size_t n = shard_count(db);
+        if (!no_shard_pending(db))
+            return EXIT_FAILURE;
+        for (size_t k = 0; k < n; ++k) {
+            std::optional<sqlite::connection> shard_db{};
+            if (k > 0)
+                shard_db.emplace(shard_file(file, k), false, opts);
+            sqlite::connection& sdb = shard_db ? *shard_db : db;
+            std::vector<std::string> names{};
+            sqlite::query q{sdb, R"(select name from entity)"};
+            q.start();
+            for (auto&& [name]: q.rows<std::string>())
+                names.push_back(std::move(name));
+            if (names.empty())
+                continue;
+            // import_msgs() replaces the contents of its output vector
+            demo::agent agent{sdb};
+            std::vector<demo::entity> imported{};
+            if (!agent.import_msgs(names, imported)) {
+                std::cerr << "Cannot import entities" << std::endl;
+                return EXIT_FAILURE;
+            }
+            std::ranges::move(imported, std::back_inserter(entities));
+        }
+    }
+    demo::policy_image::compile(file, entities);
+    std::cout << "Compiled entities: " << entities.size() << std::endl;
+    return EXIT_SUCCESS;
+}
+
+//! A streaming cursor over operation requests
+/*! Requests are read from table \c request ordered by id, in pages of a
+ * bounded size selected by <tt>id > <em>last_id</em> limit
+ * <em>page_size</em></tt>. While operations from the current page are
+ * executed, the next page is fetched by a background thread using a separate
+ * read-only connection. Requests appended to the table while the cursor is in
+ * use are returned, too, if their ids are greater than the id of the last
+ * request fetched so far. The cursor ends when there is no such request, but
+ * it can be resumed by calling next() again, possibly after wait() detects a
+ * change of the database.
+ *
+ * If the database uses exclusive locking, no other connection can be opened
+ * and pages are fetched synchronously by the connection passed to the
+ * constructor. */
+class request_cursor {
+public:
+    //! The default maximum number of requests in a page
+    static constexpr int64_t default_page_size = 1024;
+    //! Creates the cursor and starts fetching the first page.
+    /*! \param[in] file the database file name
+     * \param[in] opts connection options
+     * \param[in] db a database connection used if \a opts require exclusive
+     * locking
+     * \param[in] page_size the maximum number of requests in a page */
+    request_cursor(std::string_view file, const sqlite::connection::options& opts, sqlite::connection& db,
+                   int64_t page_size = default_page_size):
+        _own_db(opts.exclusive ? nullptr : std::make_unique<sqlite::connection>(std::string{file}, false, opts)),
+        _db(_own_db ? *_own_db : db),
+        _launch(_own_db ? std::launch::async : std::launch::deferred),
+        _page_size(page_size)
+    {
+        if (_own_db)
+            sqlite::query(*_own_db, R"(pragma query_only = 1)").start().next_row();
+        prefetch(_last);
+    }
+    //! Gets the next request.
+    /*! \return the request, or \c nullptr if there are no more requests; the
+     * pointer is valid until the next call
+     * \throw std::runtime_error if a request contains an unknown operation
+     * \throw sqlite::error if reading requests from the database fails */
+    op_record* next() {
+        if (++_pos < _page.size())
+            return &_page[_pos];
+        _page = _next.valid() ? _next.get() : page_t{};
+        _pos = 0;
+        // The page may have been fetched before other requests were appended
+        if (_page.empty())
+            _page = fetch(_last);
+        if (_page.empty())
+            return nullptr;
+        _last = _page.back().id;
+        prefetch(_last);
+        return &_page[_pos];
+    }
+    //! Waits until the database is changed by another connection.
+    /*! It should be called after next() returned \c nullptr. It polls
+     * <tt>PRAGMA data_version</tt> with exponentially increasing delays
+     * between \ref min_poll_delay and \ref max_poll_delay. Any change
+     * committed after the last fetch of a page is detected. If the database
+     * uses exclusive locking, other connections cannot change it and this
+     * function returns only if \a stop is set.
+     * \param[in] stop a flag, typically set by a signal handler, that stops
+     * waiting
+     * \return \c true if the database has been changed, \c false if stopped
+     * by \a stop */
+    bool wait(const volatile std::sig_atomic_t& stop) {
+        assert(!_next.valid());
+        for (auto delay = min_poll_delay; !stop; delay = std::min(2 * delay, max_poll_delay)) {
+            std::this_thread::sleep_for(delay);
+            if (data_version() != _version)
+                return true;
+        }
+        return false;
+    }
+    //! The initial delay between polls in wait()
+    static constexpr std::chrono::milliseconds min_poll_delay{1};
+    //! The maximum delay between polls in wait()
+    static constexpr std::chrono::milliseconds max_poll_delay{500};
+private:
+    //! A page of requests
+    using page_t = std::vector<op_record>;
+    //! Starts fetching the next page.
+    /*! \param[in] last the id of the last request of the current page */
+    void prefetch(int64_t last) {
+        _next = std::async(_launch, [this, last]() { return fetch(last); });
+    }
+    //! Fetches a page of requests.
+    /*! \param[in] last the id of the last request already fetched
+     * \return the page, empty if there are no more requests */
+    page_t fetch(int64_t last) {
+        // Any later change will be detected by wait()
+        _version = data_version();
+        page_t page;
+        page.reserve(size_t(_page_size));
+        _query.start().bind_all(last, _page_size);
+        for (auto&& [id, subject, object, op_name, arg, comment]:
+             _query.rows<int64_t, std::string, std::string, std::string_view,
+             std::optional<std::string>, std::optional<std::string>>())
+        {
+            op_record op{.id = id, .subject = std::move(subject), .object = std::move(object),
+                .op = demo::operation::find(op_name)};
+            if (!op.op)
+                throw std::runtime_error("Unknown operation name \"" + std::string{op_name} +
+                                         "\" in table REQUEST");
+            op.arg = std::move(arg).value_or(std::string{});
+            op.comment = std::move(comment).value_or(std::string{});
+            page.push_back(std::move(op));
+        }
+        return page;
+    }
+    //! Gets the data version of the database.
+    /*! \return the value of <tt>PRAGMA data_version</tt> */
+    int64_t data_version() {
+        _query_version.start().next_row();
+        auto v = _query_version.get<int64_t>(0);
+        // Do not keep the read transaction open while waiting
+        _query_version.start();
+        return v;
+    }
+    std::unique_ptr<sqlite::connection> _own_db; //!< The connection for fetching in background
+    sqlite::connection& _db; //!< The connection used for fetching
+    std::launch _launch; //!< Whether to fetch in background
+    int64_t _page_size; //!< The maximum number of requests in a page
+    //! The query fetching a page
+    sqlite::query _query{_db,
+        R"(select id, subject, object, op, arg, comment from request where id > ?1 order by id limit ?2)"};
+    //! The query getting the data version
+    sqlite::query _query_version{_db, R"(pragma data_version)"};
+    int64_t _version = 0; //!< The data version before the last fetch of a page
+    page_t _page; //!< The current page
+    size_t _pos = 0; //!< The current position in \ref _page
+    int64_t _last = std::numeric_limits<int64_t>::min(); //!< The id of the last request fetched
+    //! The next page being fetched, it must be destroyed first, waiting for the fetch to finish
+    std::future<page_t> _next;
+};
+
+//! Entities imported and a verdict computed for an operation before its transaction
+struct op_prepared {
+    std::vector<demo::entity> imported{}; //!< The subject and the object, empty if not imported
+    demo::verdict verdict{}; //!< The result of the SOFI tests
+};
+
+//! A pool of threads preparing operations for cmd_run()
+/*! Each worker thread has its own reader connection from a sqlite::pool, its
+ * own demo::agent, and its own demo::engine. It imports the subject and the
+ * object of an operation and evaluates the SOFI tests. Executing the
+ * operation and exporting the entities is left to the writer thread.
+ *
+ * An operation must be submitted only after all previous operations
+ * modifying its entities have been committed. Then it imports the same
+ * entities as if operations were executed sequentially. */
+class op_workers {
+public:
+    //! Starts worker threads.
+    /*! \param[in] pool a connection pool providing reader connections
+     * \param[in] n the number of threads */
+    op_workers(sqlite::pool& pool, unsigned n): _pool(pool) {
+        for (unsigned i = 0; i < n; ++i)
+            _threads.emplace_back([this]() { run(); });
+    }
+    //! No copy
+    op_workers(const op_workers&) = delete;
+    //! No move
+    op_workers(op_workers&&) = delete;
+    //! Waits until submitted operations are prepared and stops worker threads.
+    ~op_workers() {
+        {
+            std::lock_guard lck{_mtx};
+            _stop = true;
+        }
+        _cv.notify_all();
+        for (auto&& t: _threads)
+            t.join();
+    }
+    //! No copy
+    op_workers& operator=(const op_workers&) = delete;
+    //! No move
+    op_workers& operator=(op_workers&&) = delete;
+    //! Submits an operation to be prepared by a worker thread.
+    /*! \param[in] o the operation, it must not be destroyed until the result
+     * is ready
+     * \return the prepared operation; it rethrows any exception thrown by
+     * import */
+    std::future<op_prepared> submit(const op_record& o) {
+        std::packaged_task<op_prepared(demo::agent&, demo::engine&)> task{
+            [&o](demo::agent& agent, demo::engine& engine) {
+                op_prepared p{};
+                if (agent.import_msgs({o.subject, o.object}, p.imported)) {
+                    assert(o.op);
+                    p.verdict = engine.operation(p.imported[0], p.imported[1], *o.op);
+                } else
+                    p.imported.clear();
+                return p;
+            }
         };
-        get_val(4, op.arg, true);
-        get_val(5, op.comment, true);
-        ops.push_back(std::move(op));
+        auto result = task.get_future();
+        {
+            std::lock_guard lck{_mtx};
+            _tasks.push_back(std::move(task));
+        }
+        _cv.notify_one();
+        return result;
+    }
+private:
+    //! The function of a worker thread
+    void run() {
+        sqlite::connection& reader = _pool.reader();
+        {
+            // Nothing is exported by this agent
+            demo::agent agent{reader, reader};
+            demo::engine engine{};
+            for (;;) {
+                std::packaged_task<op_prepared(demo::agent&, demo::engine&)> task{};
+                {
+                    std::unique_lock lck{_mtx};
+                    _cv.wait(lck, [this]() { return _stop || !_tasks.empty(); });
+                    if (_tasks.empty())
+                        break;
+                    task = std::move(_tasks.front());
+                    _tasks.pop_front();
+                }
+                task(agent, engine);
+            }
+        }
+        _pool.release_reader();
+    }
+    sqlite::pool& _pool; //!< The connection pool
+    std::mutex _mtx{}; //!< Protects \ref _tasks and \ref _stop
+    std::condition_variable _cv{}; //!< Signals changes of \ref _tasks and \ref _stop
+    std::deque<std::packaged_task<op_prepared(demo::agent&, demo::engine&)>> _tasks{}; //!< Queued operations
+    bool _stop = false; //!< Requests termination of worker threads
+    std::vector<std::thread> _threads{}; //!< Worker threads
+};
+
+//! An operation in the scheduling window of cmd_run()
+struct op_job {
+    op_record rec; //!< The operation
+    std::optional<std::future<op_prepared>> prepared{}; //!< Set if submitted to op_workers
+    //! Gets names of entities read or modified by the operation.
+    /*! \return the subject, the object, and the entity created by \c clone */
+    [[nodiscard]] std::vector<std::string_view> entities() const {
+        std::vector<std::string_view> names{rec.subject, rec.object};
+        if (rec.op && rec.op->id() == demo::op_id::clone)
+            names.emplace_back(rec.arg);
+        return names;
+    }
+};
+
+//! Entities partitioned into database files (shards) by hashes of their names
+/*! The number of shards is stored in table \c shards of shard 0, which is
+ * the main database file containing also requests and results. Shard \e k > 0
+ * is stored in file shard_file(). An entity belongs to the shard selected by
+ * shard_of(). Entities are moved to their shards by command \c reshard.
+ *
+ * Each shard has its own sqlite::pool, hence its own writer connection, and
+ * writing to a shard does not block writing to other shards. Entities of an
+ * operation may be stored in different shards. Therefore, changes of
+ * entities made by a batch of operations are committed by two phases:
+ * <ol>
+ * <li>Entities are staged in memory by stage() and stage_destroy().
+ * The transaction of shard 0 that inserts results of the batch also stores
+ * the staged entities in table \c shard_pending by write_pending(). Its
+ * commit is the decision point of the batch.
+ * <li>apply() writes the staged entities to their shards by parallel
+ * transactions, one writer thread per shard, and then deletes them from \c
+ * shard_pending.
+ * </ol>
+ * If the program terminates between the phases, the pending entities are
+ * written to their shards by the constructor when the database is opened
+ * next time. Writing an entity is idempotent, hence it can be repeated. */
+class shard_set {
+public:
+    //! Opens all shards and writes entities left pending by an interrupted run.
+    /*! \param[in] file the database file name of shard 0
+     * \param[in] opts connection options
+     * \param[in] main the connection pool of shard 0
+     * \throw sqlite::error if a shard cannot be opened or written */
+    shard_set(std::string_view file, const sqlite::connection::options& opts, sqlite::pool& main);
+    //! Gets the number of shards.
+    /*! \return the number of shards */
+    [[nodiscard]] size_t size() const noexcept {
+        return _shards.size();
+    }
+    //! Imports entities from their shards.
+    /*! Entities stored in the same shard are imported by a single query.
+     * \param[in] names entity names
+     * \param[out] e imported entities, in the same order as \a names
+     * \return the result of import, an error if any of the entities cannot be
+     * imported
+     * \throw sqlite::busy_error if the database is busy */
+    soficpp::agent_result import_msgs(const std::vector<std::string>& names, std::vector<demo::entity>& e);
+    //! Stages an entity to be written to its shard.
+    /*! \param[in] e an entity */
+    void stage(demo::entity e) {
+        std::string name = e.name;
+        _staged.emplace_back(std::move(name), std::move(e));
+    }
+    //! Stages an entity to be deleted from its shard.
+    /*! \param[in] name an entity name */
+    void stage_destroy(std::string name) {
+        _staged.emplace_back(std::move(name), std::nullopt);
+    }
+    //! Discards all staged entities.
+    /*! It must be called before a rolled back transaction is retried. */
+    void clear_staged() noexcept {
+        _staged.clear();
+    }
+    //! Stores staged entities in table \c shard_pending.
+    /*! It must be called in the transaction of shard 0 that commits results of
+     * operations which have modified the staged entities. */
+    void write_pending();
+    //! Writes staged entities to their shards.
+    /*! It must be called after the transaction calling write_pending() has
+     * been committed. Shards are written in parallel. Then the entities are
+     * deleted from table \c shard_pending and from the stage.
+     * \throw std::runtime_error if an entity cannot be exported
+     * \throw sqlite::error if writing a shard fails, the entities stay
+     * pending */
+    void apply();
+private:
+    //! A staged entity, \c std::nullopt if it is destroyed
+    using staged_t = std::pair<std::string, std::optional<demo::entity>>;
+    //! Connections and an agent of a shard
+    struct shard {
+        //! Creates the agent for a shard.
+        /*! \param[in] p the connection pool of the shard */
+        explicit shard(sqlite::pool& p);
+        sqlite::pool& pool; //!< The connection pool
+        demo::agent agent; //!< Exports by the writer, imports by the reader of the main thread
+        sqlite::query_lease del_entity; //!< SQL query for deleting an entity
+    };
+    //! Writes entities to a shard in a single transaction.
+    /*! \param[in] s a shard
+     * \param[in] entities staged entities belonging to \a s */
+    static void write(shard& s, const std::vector<const staged_t*>& entities);
+    sqlite::connection& _main; //!< The writer connection of shard 0
+    sqlite::query_lease _ins_pending; //!< SQL query for inserting into SHARD_PENDING
+    sqlite::query_lease _del_pending; //!< SQL query for deleting from SHARD_PENDING
+    std::vector<std::unique_ptr<sqlite::pool>> _pools{}; //!< Connection pools of shards except shard 0
+    std::vector<std::unique_ptr<shard>> _shards{}; //!< All shards, indexed by shard numbers
+    std::vector<staged_t> _staged{}; //!< Staged entities
+};
+
+shard_set::shard::shard(sqlite::pool& p):
+    pool(p), agent(p.writer(), p.reader()), del_entity(p.writer().cached(R"(delete from entity where name = ?1)"))
+{
+    // Check foreign key constrains, must be set for every connection outside of transactions
+    sqlite::query(p.writer(), R"(pragma foreign_keys=1)").start().next_row();
+}
+
+shard_set::shard_set(std::string_view file, const sqlite::connection::options& opts, sqlite::pool& main):
+    _main(main.writer()),
+    _ins_pending(_main.cached(R"(insert or replace into shard_pending values (?1, ?2, ?3))")),
+    _del_pending(_main.cached(R"(delete from shard_pending)"))
+{
+    size_t n = shard_count(_main);
+    for (size_t k = 0; k < n; ++k) {
+        sqlite::pool* p = &main;
+        if (k > 0)
+            p = _pools.emplace_back(std::make_unique<sqlite::pool>(shard_file(file, k), opts)).get();
+        _shards.push_back(std::make_unique<shard>(*p));
+    }
+    // Complete writing entities committed by an interrupted run
+    {
+        sqlite::query q{_main, R"(select name, policy, data from shard_pending)"};
+        q.start();
+        for (auto&& [name, policy, data]:
+             q.rows<std::string, std::optional<sqlite::blob_t>, std::optional<std::string>>())
+        {
+            if (policy) {
+                demo::entity e{};
+                e.name = std::move(name);
+                demo::policy_blob::decode(*policy, e);
+                e.data = std::move(data).value_or(std::string{});
+                stage(std::move(e));
+            } else
+                stage_destroy(std::move(name));
+        }
+    }
+    if (!_staged.empty()) {
+        std::cout << "RECOVER " << _staged.size() << " pending entities" << std::endl;
+        apply();
+    }
+}
+
+soficpp::agent_result shard_set::import_msgs(const std::vector<std::string>& names, std::vector<demo::entity>& e)
+{
+    std::vector<std::vector<size_t>> by_shard(size());
+    for (size_t i = 0; i < names.size(); ++i)
+        by_shard[shard_of(names[i], size())].push_back(i);
+    e.assign(names.size(), demo::entity{});
+    for (size_t k = 0; k < size(); ++k) {
+        if (by_shard[k].empty())
+            continue;
+        std::vector<std::string> m{};
+        for (size_t i: by_shard[k])
+            m.push_back(names[i]);
+        std::vector<demo::entity> imported{};
+        if (!_shards[k]->agent.import_msgs(m, imported))
+            return soficpp::agent_result{soficpp::agent_result::error};
+        for (size_t j = 0; j < imported.size(); ++j)
+            e[by_shard[k][j]] = std::move(imported[j]);
+    }
+    return soficpp::agent_result{soficpp::agent_result::success};
+}
+
+void shard_set::write_pending()
+{
+    for (auto&& [name, e]: _staged) {
+        std::optional<sqlite::blob_t> policy{};
+        std::optional<std::string_view> data{};
+        if (e) {
+            policy = demo::policy_blob::encode(*e);
+            data = e->data.str();
+        }
+        _ins_pending->start().bind_all(name, policy, data).next_row();
+    }
+}
+
+void shard_set::apply()
+{
+    if (_staged.empty())
+        return;
+    std::vector<std::vector<const staged_t*>> by_shard(size());
+    for (auto&& s: _staged)
+        by_shard[shard_of(s.first, size())].push_back(&s);
+    {
+        // One writer thread per shard
+        std::vector<std::future<void>> writers{};
+        for (size_t k = 0; k < size(); ++k)
+            if (!by_shard[k].empty())
+                writers.push_back(std::async(std::launch::async, write, std::ref(*_shards[k]),
+                                             std::cref(by_shard[k])));
+        for (auto&& w: writers)
+            w.get();
+    }
+    _del_pending->start().next_row();
+    _staged.clear();
+}
+
+void shard_set::write(shard& s, const std::vector<const staged_t*>& entities)
+{
+    bool retried = false;
+    sqlite::retry_transaction(s.pool.writer(), [&](sqlite::transaction&) {
+        if (retried)
+            s.agent.reset();
+        retried = true;
+        for (auto&& p: entities)
+            if (auto&& e = p->second) {
+                std::string exported{};
+                if (!s.agent.export_msg(*e, exported))
+                    throw std::runtime_error("Cannot export entity \"" + e->name + "\" to its shard");
+            } else
+                s.del_entity->start().bind(1, p->first).next_row();
+    });
+}
+
+//! The maximum number of operations committed by a single transaction of cmd_run()
+constexpr size_t max_batch = 64;
+
+//! Set by a signal handler to stop cmd_serve()
+volatile std::sig_atomic_t stop_serving = 0;
+
+//! Evaluates SOFI operations using a demo::policy_image
+/*! For each request in table \c request, it imports the subject and the
+ * object from the image created by cmd_compile() and prints the verdict of
+ * the operation. Operations are not executed, therefore, each verdict is
+ * computed from the entities as they were compiled, and neither the database
+ * nor the image is modified.
+ * \param[in] file the database file name
+ * \param[in] opts connection options
+ * \return program exit code, \c EXIT_FAILURE if any subject or object does
+ * not exist in the image */
+int cmd_check(std::string_view file, const sqlite::connection::options& opts)
+{
+    demo::policy_image image{file};
+    sqlite::connection db{std::string{file}, false, opts};
+    sqlite::query(db, R"(pragma query_only = 1)").start().next_row();
+    request_cursor requests{file, opts, db};
+    demo::engine engine{};
+    int result = EXIT_SUCCESS;
+    while (op_record* o = requests.next()) {
+        demo::entity subject{};
+        demo::entity object{};
+        if (!image.import_msg(o->subject, subject) || !image.import_msg(o->object, object)) {
+            std::cerr << "Cannot import subject \"" << o->subject << "\" or object \"" << o->object << "\"" <<
+                std::endl;
+            result = EXIT_FAILURE;
+            continue;
+        }
+        assert(o->op);
+        demo::verdict verdict = engine.operation(subject, object, *o->op);
+        std::cout << "CHECK " << o->id << " allowed=" << verdict.allowed() << " access=" <<
+            verdict.access_test() << " min=" << verdict.min_test() << std::endl;
     }
-    return ops;
+    return result;
 }
 
 //! Executes SOFI operation in a database
-/*! \param[in] file the database file name
+/*! Operations are executed in batches of consecutive requests operating on
+ * different entities, up to \ref max_batch operations in a batch. Each batch
+ * is committed by a single transaction, which inserts all results by a single
+ * statement and deletes the requests by their range of IDs. If an operation
+ * fails, operations preceding it in the batch are committed.
+ *
+ * With \a jobs greater than 1, operations are scheduled from a window of
+ * consecutive requests. Each operation is submitted to op_workers as soon as
+ * no earlier operation in the window uses any of its entities, that is, the
+ * window is a dependency graph with edges given by shared entity names.
+ * Operations are committed by the writer connection in the order of request
+ * IDs, therefore, results are the same as of sequential execution. This
+ * requires that no other program modifies entities while \c sofi_demo is
+ * running.
+ *
+ * If the database is partitioned into several shards, entities are imported
+ * from and written to their shards by a shard_set, and \a jobs is ignored.
+ *
+ * If \a store is storage::log, entities are stored by a demo::log_agent and
+ * table \c entity is not modified, but it is used to initialize the
+ * log_agent if it does not exist yet. The log records of a batch are written
+ * before the transaction of the batch is committed. Then \a jobs is ignored.
+ * If \a store is storage::database and entities are stored in a log, the
+ * function fails until the log is moved to the database by cmd_checkpoint().
+ * \param[in] file the database file name
+ * \param[in] opts connection options
+ * \param[in] jobs the number of threads preparing operations in parallel,
+ * ignored if \a opts require exclusive locking
+ * \param[in] store the storage of entities
+ * \param[in] serve if \c false, return after executing all requests; if \c
+ * true, wait for new requests until \ref stop_serving is set
  * \return program exit code */
-int cmd_run(std::string_view file)
+int cmd_run(std::string_view file, const sqlite::connection::options& opts, unsigned jobs, storage store,
+            bool serve = false)
 {
-    sqlite::connection db{std::string{file}, false};
+    if (store == storage::database && !no_log_storage(file))
+        return EXIT_FAILURE;
+    // Results are written by the writer connection, entities are imported by a
+    // reader connection. Each batch is committed before the next one imports
+    // its entities.
+    sqlite::pool pool{std::string{file}, opts};
+    sqlite::connection& db = pool.writer();
     // Check foreign key constrains, must be set for every connection outside of transactions
     sqlite::query(db, R"(pragma foreign_keys=1)").start().next_row();
-    // Read all operation requests
-    std::deque<op_record> ops = get_op_requests(db);
+    // Read operation requests in pages, including requests appended while running
+    request_cursor requests{file, opts, db};
     // Execute operations
     demo::engine engine{};
-    demo::agent agent{db};
-    sqlite::query sql_del_request{db, R"(delete from request where id = ?1)"};
-    sqlite::query sql_ins_result{db, R"(insert into result values (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10))"};
+    demo::agent agent{db, pool.reader()};
+    // Entities in shards other than this database are written after each batch
+    std::optional<shard_set> shards{};
+    if (shard_count(db) > 1)
+        shards.emplace(file, opts, pool);
+    // Entities stored in a log instead of table ENTITY
+    std::optional<demo::log_agent> log{};
+    if (store == storage::log) {
+        if (shards) {
+            std::cerr << "Entities in shards cannot be stored in a log" << std::endl;
+            return EXIT_FAILURE;
+        }
+        bool init = !demo::log_agent::exists(file);
+        log.emplace(file, committed_request(db));
+        if (init) {
+            std::vector<std::string> names{};
+            sqlite::query q{db, R"(select name from entity)"};
+            q.start();
+            for (auto&& [name]: q.rows<std::string>())
+                names.push_back(std::move(name));
+            std::vector<demo::entity> entities{};
+            if (!names.empty() && !agent.import_msgs(names, entities)) {
+                std::cerr << "Cannot import entities to the log" << std::endl;
+                return EXIT_FAILURE;
+            }
+            log->assign(std::move(entities));
+        }
+    }
+    // Results of a batch are inserted by a single statement from a JSON array
+    sqlite::query sql_ins_results{db, R"(
+        insert into result select
+            json_extract(value, '$[0]'), json_extract(value, '$[1]'), json_extract(value, '$[2]'),
+            json_extract(value, '$[3]'), json_extract(value, '$[4]'), json_extract(value, '$[5]'),
+            json_extract(value, '$[6]'), json_extract(value, '$[7]'), json_extract(value, '$[8]'),
+            json_extract(value, '$[9]')
+        from json_each(?1))"};
+    // Requests of a batch have consecutive IDs in table REQUEST
+    sqlite::query sql_del_requests{db, R"(delete from request where id between ?1 and ?2)"};
     sqlite::query sql_del_entity{db, R"(delete from entity where name = ?1)"};
-    for (auto& o: ops) {
+    // Readers of the pool would see uncommitted changes with exclusive locking,
+    // workers would need readers of all shards
+    if (opts.exclusive || shards || log)
+        jobs = 1;
+    const size_t window_size = std::max(max_batch, 4 * size_t(jobs));
+    std::deque<op_job> window{};
+    // Destroyed before the window, because it uses operations in the window
+    std::optional<op_workers> workers{};
+    if (jobs > 1)
+        workers.emplace(pool, jobs);
+    // Executes a single operation in a transaction of a batch
+    auto exec = [&](op_record& o, std::optional<op_prepared>& prepared) {
         std::cout << "BEGIN " << o.id << ": " << o.comment << std::endl;
-        sqlite::transaction tr{db};
-        sql_del_request.start().bind(1, o.id).next_row();
-        demo::entity subject;
-        if (!agent.import_msg(o.subject, subject)) {
-            std::cerr << "Cannot import subject \"" << o.subject << "\"" << std::endl;
-            return EXIT_FAILURE;
+        // Import both entities by a single query
+        std::vector<demo::entity> imported{};
+        if (prepared)
+            imported = std::move(prepared->imported);
+        else if (!(log ? log->import_msgs({o.subject, o.object}, imported) :
+                   shards ? shards->import_msgs({o.subject, o.object}, imported) :
+                   agent.import_msgs({o.subject, o.object}, imported)))
+        {
+            imported.clear();
         }
-        assert(o.subject == subject.name);
-        std::cout << "import subject(" << subject.name << ")=" << subject << " test=" << subject.test_fun_name <<
-            " prov=" << subject.prov_fun_name << " recv=" << subject.recv_fun_name << std::endl;
-        demo::entity object;
-        if (!agent.import_msg(o.object, object)) {
-            std::cerr << "Cannot import object \"" << o.object << "\"" << std::endl;
-            return EXIT_FAILURE;
+        if (imported.empty()) {
+            std::cerr << "Cannot import subject \"" << o.subject << "\" or object \"" << o.object << "\"" <<
+                std::endl;
+            return false;
         }
+        demo::entity& subject = imported[0];
+        demo::entity& object = imported[1];
+        assert(o.subject == subject.name);
+        std::cout << "import subject(" << subject.name << ")=" << subject <<
+            " test=" << subject.test_fun_name << " prov=" << subject.prov_fun_name <<
+            " recv=" << subject.recv_fun_name << std::endl;
         assert(o.object == object.name);
-        std::cout << "import object(" << object.name << ")=" << object << " test=" << object.test_fun_name <<
-            " prov=" << object.prov_fun_name << " recv=" << object.recv_fun_name << std::endl;
+        std::cout << "import object(" << object.name << ")=" << object <<
+            " test=" << object.test_fun_name << " prov=" << object.prov_fun_name <<
+            " recv=" << object.recv_fun_name << std::endl;
         assert(o.op);
-        demo::verdict verdict = engine.operation(subject, object, *o.op);
+        demo::verdict verdict = prepared ? prepared->verdict : engine.operation(subject, object, *o.op);
         std::cout << *o.op << " -> " << verdict << std::endl;
-        if (verdict) {
-            demo::operation::attach_db(&db);
+        if (verdict)
             o.op->execute(subject, object, o.arg, verdict);
-            demo::operation::attach_db();
-        }
         o.allowed = verdict.allowed();
         o.access = verdict.access_test();
         o.min = verdict.min_test();
         o.error = verdict.error;
         o.destroy = verdict.destroy;
-        std::string exported_subject{};
-        std::string exported_object{};
+        // Exports an entity, or stages it for its shard
+        auto export_entity = [&](const demo::entity& e, std::string_view role) {
+            if (shards) {
+                shards->stage(e);
+                return true;
+            }
+            std::string exported{};
+            if (!(log ? log->export_msg(e, exported) : agent.export_msg(e, exported))) {
+                std::cerr << "Cannot export " << role << " \"" << e.name << "\"" << std::endl;
+                return false;
+            }
+            assert(e.name == exported);
+            return true;
+        };
         std::cout << "export subject(" << subject.name << ")=" << subject << std::endl;
-        if (!agent.export_msg(subject, exported_subject)) {
-            std::cerr << "Cannot export subject \"" << subject.name << "\"" << std::endl;
-            return EXIT_FAILURE;
-        }
-        assert(subject.name == exported_subject);
+        if (!export_entity(subject, "subject"))
+            return false;
         if (o.destroy) {
             std::cout << "destroy object(" << object.name << ')' << std::endl;
-            sql_del_entity.start().bind(1, object.name).next_row();
+            if (log)
+                log->erase(object.name);
+            else if (shards)
+                shards->stage_destroy(object.name);
+            else
+                sql_del_entity.start().bind(1, object.name).next_row();
         } else {
             std::cout << "export object(" << object.name << ")=" << object << std::endl;
-            if (!agent.export_msg(object, exported_object)) {
-                std::cerr << "Cannot export object \"" << object.name << "\"" << std::endl;
-                return EXIT_FAILURE;
+            if (!export_entity(object, "object"))
+                return false;
+        }
+        if (verdict.clone) {
+            std::cout << "clone object(" << object.name << ")=" << o.arg << std::endl;
+            // In table ENTITY, the object has just been exported, therefore,
+            // its row is copied; the copy in a shard or a log is exported.
+            if (log || shards) {
+                demo::entity cloned = object;
+                cloned.name = o.arg;
+                if (!export_entity(cloned, "cloned object"))
+                    return false;
+            } else if (!agent.clone_msg(object.name, o.arg)) {
+                std::cerr << "Cannot clone object \"" << object.name << "\"" << std::endl;
+                return false;
             }
-            assert(object.name == exported_object);
         }
-        sql_ins_result.start().
-            bind(1, o.id).bind(2, o.subject).bind(3, o.object).bind(4, o.op->name()).bind(5, o.arg).bind(6, o.comment).
-            bind(7, o.allowed).bind(8, o.access).bind(9, o.min).bind(10, o.error).
-            next_row();
-        tr.commit();
-        std::cout << "END   " << o.id << " allowed=" << o.allowed <<
-            " access=" << o.access << " min=" << o.min << " error=" << o.error << " destroy=" << o.destroy << std::endl;
+        return true;
+    };
+    // Set if the cursor has ended since the window was empty
+    bool drained = false;
+    for (;;) {
+        // Stops after a committed batch, leaving remaining requests in the database
+        if (serve && stop_serving)
+            break;
+        if (!drained || window.empty()) {
+            drained = false;
+            while (window.size() < window_size)
+                if (op_record* po = requests.next())
+                    window.push_back(op_job{.rec = std::move(*po)});
+                else {
+                    drained = true;
+                    break;
+                }
+        }
+        if (window.empty()) {
+            if (serve && requests.wait(stop_serving))
+                continue;
+            break;
+        }
+        // A batch is the longest prefix of the window without operations on
+        // the same entity, hence all its operations import committed entities
+        size_t batch = 0;
+        {
+            std::unordered_set<std::string_view> used{};
+            bool in_batch = true;
+            for (auto&& j: window) {
+                auto names = j.entities();
+                bool independent = std::ranges::none_of(names, [&used](auto&& n) { return used.contains(n); });
+                in_batch = in_batch && independent && batch < max_batch;
+                if (in_batch)
+                    ++batch;
+                if (workers && !j.prepared && independent)
+                    j.prepared = workers->submit(j.rec);
+                used.insert(names.begin(), names.end());
+            }
+        }
+        assert(batch > 0);
+        std::vector<std::optional<op_prepared>> prepared(batch);
+        for (size_t i = 0; i < batch; ++i)
+            if (auto& f = window[i].prepared)
+                try {
+                    prepared[i] = f->get();
+                } catch (const sqlite::busy_error&) {
+                    // Imported again by the transaction
+                }
+        // The transaction is executed again if the database is busy. If an
+        // operation fails, the transaction is executed again with the
+        // operations preceding the failed one, which are then committed.
+        bool failed = false;
+        bool retried = false;
+        bool shrunk = false;
+        auto exec_batch = [&](sqlite::transaction& tr) {
+            if (shrunk) {
+                std::cout << "SHRINK " << window.front().rec.id << " batch=" << batch << std::endl;
+                shrunk = false;
+            } else if (retried)
+                std::cout << "RETRY " << window.front().rec.id << std::endl;
+            if (retried) {
+                agent.reset();
+                std::ranges::fill(prepared, std::nullopt);
+            }
+            retried = true;
+            if (shards)
+                shards->clear_staged();
+            if (log)
+                log->rollback();
+            std::string results{"["};
+            for (size_t i = 0; i < batch; ++i) {
+                op_record& o = window[i].rec;
+                if (!exec(o, prepared[i])) {
+                    tr.rollback();
+                    batch = i;
+                    failed = true;
+                    return false;
+                }
+                results += i > 0 ? ",[" : "[";
+                results += std::to_string(o.id);
+                for (std::string_view v: {std::string_view{o.subject}, std::string_view{o.object}, o.op->name(),
+                     std::string_view{o.arg}, std::string_view{o.comment}})
+                {
+                    results += ',';
+                    demo::json_quote(results, v);
+                }
+                for (bool v: {o.allowed, o.access, o.min, o.error})
+                    results += v ? ",true" : ",false";
+                results += ']';
+            }
+            results += ']';
+            sql_ins_results.start().bind(1, results).next_row();
+            sql_del_requests.start().bind_all(window.front().rec.id, window[batch - 1].rec.id).next_row();
+            if (shards)
+                shards->write_pending();
+            if (log)
+                log->commit(window[batch - 1].rec.id);
+            return true;
+        };
+        while (!sqlite::retry_transaction(db, exec_batch)) {
+            if (batch == 0)
+                return EXIT_FAILURE;
+            shrunk = true;
+        }
+        if (shards)
+            shards->apply();
+        if (log)
+            log->apply();
+        for (size_t i = 0; i < batch; ++i) {
+            op_record& o = window.front().rec;
+            std::cout << "END   " << o.id << " allowed=" << o.allowed << " access=" << o.access <<
+                " min=" << o.min << " error=" << o.error << " destroy=" << o.destroy << std::endl;
+            window.pop_front();
+        }
+        if (failed)
+            return EXIT_FAILURE;
     }
     return EXIT_SUCCESS;
 }
 
+//! Executes SOFI operations in a database, waiting for new requests
+/*! It works like cmd_run(), but instead of exiting when there are no more
+ * requests, it waits for new requests inserted by other programs. The program
+ * stays resident, keeping warm caches and prepared statements. It exits after
+ * receiving \c SIGINT or \c SIGTERM, after committing the current batch of
+ * up to \ref max_batch requests. Requests not included in the batch stay in
+ * the database.
+ * \param[in] file the database file name
+ * \param[in] opts connection options
+ * \param[in] jobs the number of threads preparing operations in parallel
+ * \param[in] store the storage of entities
+ * \return program exit code */
+int cmd_serve(std::string_view file, const sqlite::connection::options& opts, unsigned jobs, storage store)
+{
+    auto handler = [](int) { stop_serving = 1; };
+    std::signal(SIGINT, handler);
+    std::signal(SIGTERM, handler);
+    return cmd_run(file, opts, jobs, store, true);
+}
+
 } // namespace
 
 //! The main function of program \c sofi_demo
@@ -1409,15 +4682,60 @@ int main(int argc, char* argv[])
 {
     using namespace std::string_literals;
     using namespace std::string_view_literals;
-    if (argc != 3)
+    int a = 1;
+    const sqlite::connection::options* opts = sqlite::connection::options::preset("default");
+    unsigned jobs = 1;
+    size_t shards = 1;
+    storage store = storage::database;
+    for (; a + 2 < argc; a += 2) {
+        std::string_view v = argv[a + 1];
+        if (argv[a] == "-p"sv) {
+            if (!(opts = sqlite::connection::options::preset(v)))
+                return usage(argv[0], "Unknown preset \""s + argv[a + 1] + "\"");
+        } else if (argv[a] == "-j"sv) {
+            if (auto [p, ec] = std::from_chars(v.data(), v.data() + v.size(), jobs);
+                ec != std::errc{} || p != v.data() + v.size() || jobs == 0)
+            {
+                return usage(argv[0], "Invalid number of jobs \""s + argv[a + 1] + "\"");
+            }
+        } else if (argv[a] == "-b"sv) {
+            if (v == "database"sv)
+                store = storage::database;
+            else if (v == "log"sv)
+                store = storage::log;
+            else
+                return usage(argv[0], "Unknown storage \""s + argv[a + 1] + "\"");
+        } else if (argv[a] == "-s"sv) {
+            if (auto [p, ec] = std::from_chars(v.data(), v.data() + v.size(), shards);
+                ec != std::errc{} || p != v.data() + v.size() || shards == 0)
+            {
+                return usage(argv[0], "Invalid number of shards \""s + argv[a + 1] + "\"");
+            }
+        } else
+            return usage(argv[0], "Unknown option \""s + argv[a] + "\"");
+    }
+    if (argc != a + 2)
         return usage(argv[0], "Invalid command line arguments");
+    assert(opts);
     try {
-        if (argv[1] == "init"sv)
-            return cmd_init(argv[2]);
-        if (argv[1] == "run"sv)
-            return cmd_run(argv[2]);
+        if (argv[a] == "init"sv)
+            return cmd_init(argv[a + 1], *opts);
+        if (argv[a] == "run"sv)
+            return cmd_run(argv[a + 1], *opts, jobs, store);
+        if (argv[a] == "serve"sv)
+            return cmd_serve(argv[a + 1], *opts, jobs, store);
+        if (argv[a] == "gc"sv)
+            return cmd_gc(argv[a + 1], *opts);
+        if (argv[a] == "reshard"sv)
+            return cmd_reshard(argv[a + 1], *opts, shards);
+        if (argv[a] == "checkpoint"sv)
+            return cmd_checkpoint(argv[a + 1], *opts);
+        if (argv[a] == "compile"sv)
+            return cmd_compile(argv[a + 1], *opts);
+        if (argv[a] == "check"sv)
+            return cmd_check(argv[a + 1], *opts);
         else
-            return usage(argv[0], "Unknown command \""s + argv[1] + "\"");
+            return usage(argv[0], "Unknown command \""s + argv[a] + "\"");
     } catch (const sqlite::error& e) {
         std::cerr << e.what() << std::endl;
     } catch (const std::exception& e) {
@@ -4,6 +4,8 @@
 
 #include <concepts>
 #include <functional>
+#include <map>
+#include <memory>
 #include <string>
 #include <type_traits>
 #include <vector>
@@ -268,7 +270,7 @@ public:
     bool test(const I& subj, [[maybe_unused]] const O& op, [[maybe_unused]] V& v,
               [[maybe_unused]] controller_test kind) const
     {
-        return subj >= integrity;
+        return geq(subj, integrity);
     }
     //! Converts the value to a string.
     /*! \return a string representation of this acl */
@@ -331,7 +333,7 @@ public:
               [[maybe_unused]] controller_test kind) const
     {
         for (auto&& i: *this)
-            if (subj >= i)
+            if (geq(subj, i))
                 return true;
         return false;
     }
@@ -457,8 +459,12 @@ private:
             os << ',';
             if constexpr (requires { os << v.first; })
                 os << v.first;
-            else if constexpr (requires { enum2str(v.first); })
-                os << enum2str(v.first);
+            else if constexpr (requires { enum2sv(v.first); }) {
+                if (auto s = enum2sv(v.first); !s.empty())
+                    os << s;
+                else
+                    os << enum2str(v.first);
+            }
             else
                 os << "?";
             os << '=';
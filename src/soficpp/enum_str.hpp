@@ -6,13 +6,14 @@
  * \test in file test_enum_str.cpp
  */
 
-#include <initializer_list>
-#include <map>
-#include <span>
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 #include <type_traits>
+#include <utility>
 
 namespace soficpp {
 
@@ -41,60 +42,100 @@ enum_str_init_t(std::pair<E, const char*>, T...) -> enum_str_init_t<E, 1 + sizeo
  * \tparam E  an enumeration type, or \c bool */
 template <can_enum_str E> inline constexpr enum_str_init_t<E, 0> enum_str_init{};
 
+//! Sorts an array at compile time.
+/*! It is an insertion sort, used for small conversion tables, because not all
+ * implementations of \c std::ranges::sort() can be evaluated at compile time.
+ * It is stable.
+ * \tparam T the element type
+ * \tparam N the number of elements
+ * \tparam K a function object type
+ * \param[in, out] a the array to be sorted
+ * \param[in] key a function getting a sort key from an element */
+template <class T, size_t N, class K> constexpr void sort_by(std::array<T, N>& a, K key)
+{
+    for (size_t i = 1; i < N; ++i)
+        for (size_t j = i; j > 0 && key(a[j]) < key(a[j - 1]); --j)
+            std::swap(a[j], a[j - 1]);
+}
+
 //! A helper class that implements conversion between an enumeration and strings
-/*! A single instance is created automatically as needed by get().
+/*! All lookup tables are generated from enum_str_init at compile time. A
+ * string is converted to a value by a binary search in a table sorted by
+ * strings. A value is converted to a string by direct indexing if the values
+ * in enum_str_init are dense, that is, they form a contiguous range of
+ * distinct numbers. Otherwise, a binary search in a table sorted by values is
+ * used.
  * \tparam E  an enumeration type, or \c bool */
 template <can_enum_str E> class enum_str {
 public:
-    //! Gets the single global instance of this class.
-    /*! \return the instance */
-    static const enum_str& get() {
-        static enum_str data;
-        return data;
-    }
     //! Converts an enumeration value to a string.
     /*! \param[in] e an enumeration value
      * \return the string corresponding to \a e if \a e is defined in the
-     * conversion table, the numeric value of \a e converted to a string
-     * otherwise */
-    std::string convert(E e) const requires std::is_enum_v<E> {
-        if (auto p = e2s.find(e); p != e2s.end())
-            return std::string{p->second};
-        else
-            return std::to_string(std::underlying_type_t<E>(e));
-    }
-    //! Converts an \c bool value to a string.
-    /*! \param[in] e a \c bool value
-     * \return the string \c "false" or \c "true" corresponding to \a e */
-    std::string convert(E e) const requires std::is_same_v<E, bool> {
-        if (auto p = e2s.find(e); p != e2s.end())
-            return std::string{p->second};
-        else
-            return std::to_string(e);
+     * conversion table, an empty string otherwise */
+    static constexpr std::string_view convert(E e) noexcept {
+        if constexpr (dense) {
+            auto i = number(e) - min_number;
+            return i >= 0 && size_t(i) < size ? by_number[size_t(i)] : std::string_view{};
+        } else {
+            auto p = std::ranges::lower_bound(by_value, number(e), {},
+                                              [](auto&& v) { return number(v.first); });
+            return p != by_value.end() && p->first == e ? p->second : std::string_view{};
+        }
     }
     //! Converts a string to an enumeration value.
     /*! \param[in] s a string
      * \return the enumeration value corresponding to \a s
      * \throw std::invalid_argument if no record for \a s is present in the
      * conversion table */
-    E convert(std::string_view s) const {
-        if (auto p = s2e.find(s); p != s2e.end())
+    static constexpr E convert(std::string_view s) {
+        auto p = std::ranges::lower_bound(by_string, s, {}, &std::pair<std::string_view, E>::first);
+        if (p != by_string.end() && p->first == s)
             return p->second;
         else
             throw std::invalid_argument("Unknown enum value");
     }
-private:
-    //! Constructs the conversion table from enum_str_init.
-    explicit enum_str() {
-        for (auto&& i: enum_str_init<E>) {
-            e2s.emplace(i.first, i.second);
-            s2e.emplace(i.second, i.first);
-        }
+    //! Gets the numeric value of an enumeration value.
+    /*! \param[in] e an enumeration value
+     * \return \a e converted to an integer */
+    static constexpr std::intmax_t number(E e) noexcept {
+        return static_cast<std::intmax_t>(e);
     }
-    //! The map for converting enumeration value to strings
-    std::map<E, std::string_view> e2s;
-    //! The map for converting strings to enumeration values
-    std::map<std::string_view, E> s2e;
+private:
+    //! The number of records in the conversion table
+    static constexpr size_t size = enum_str_init<E>.size();
+    //! The table for converting strings to enumeration values, sorted by strings
+    static constexpr auto by_string = []() {
+        std::array<std::pair<std::string_view, E>, size> t{};
+        for (size_t i = 0; i < size; ++i)
+            t[i] = {enum_str_init<E>[i].second, enum_str_init<E>[i].first};
+        sort_by(t, [](auto&& v) { return v.first; });
+        return t;
+    }();
+    //! The table for converting enumeration values to strings, sorted by values
+    static constexpr auto by_value = []() {
+        std::array<std::pair<E, std::string_view>, size> t{};
+        for (size_t i = 0; i < size; ++i)
+            t[i] = {enum_str_init<E>[i].first, enum_str_init<E>[i].second};
+        sort_by(t, [](auto&& v) { return number(v.first); });
+        return t;
+    }();
+    //! The smallest value in the conversion table
+    static constexpr std::intmax_t min_number = size > 0 ? number(by_value.front().first) : 0;
+    //! Whether the values in the conversion table are distinct and form a contiguous range
+    static constexpr bool dense = []() {
+        for (size_t i = 0; i < size; ++i)
+            if (number(by_value[i].first) != min_number + std::intmax_t(i))
+                return false;
+        return true;
+    }();
+    //! The table for converting enumeration values to strings, indexed by values minus \ref min_number
+    static constexpr auto by_number = []() {
+        std::array<std::string_view, dense ? size : 0> t{};
+        if constexpr (dense)
+            for (size_t i = 0; i < size; ++i)
+                t[i] = by_value[i].second;
+        return t;
+    }();
 };
 
 //! Specialization of enum_string_init for type \c bool
@@ -116,6 +157,22 @@ template <> inline constexpr enum_str_init_t enum_str_init<bool>{
 #define SOFICPP_IMPL_ENUM_STR_VAL(type, value) \
     std::pair{type::value, #value}
 
+//! Converts an enumeration or \c bool value to a string view.
+/*! It does not allocate memory.
+ * \tparam E the type to be converted
+ * \param[in] e the value to be converted
+ * \return the string defined for \a e in the conversion table, or an empty
+ * string if \a e is not present in the table
+ *
+ * Before it can be used for an enumeration type \a E, the specialization \c
+ * enum_str_init<E> must be defined as described in the documentation of
+ * enum2str().
+ * \test in file test_enum_str.cpp */
+template <impl::can_enum_str E> constexpr std::string_view enum2sv(E e) noexcept
+{
+    return impl::enum_str<E>::convert(e);
+}
+
 //! Converts an enumeration or \c bool value to a string.
 /*! \tparam E the type to be converted
  * \param[in] e the value to be converted
@@ -132,10 +189,13 @@ template <> inline constexpr enum_str_init_t enum_str_init<bool>{
        ...
  * };
  * \endcode
+ * Use enum2sv() to avoid allocating a new string.
  * \test in file test_enum_str.cpp */
 template <impl::can_enum_str E> std::string enum2str(E e)
 {
-    return impl::enum_str<E>::get().convert(e);
+    if (auto s = enum2sv(e); !s.empty())
+        return std::string{s};
+    return std::to_string(impl::enum_str<E>::number(e));
 }
 
 //! Converts a string to an enumeration or \c bool value.
@@ -149,9 +209,9 @@ template <impl::can_enum_str E> std::string enum2str(E e)
  * enumeration type \a E, the specialization \c enum_str_init<E> must be
  * defined as described in the documentation of enum2str().
  * \test in file test_enum_str.cpp */
-template <impl::can_enum_str E> E str2enum(std::string_view s)
+template <impl::can_enum_str E> constexpr E str2enum(std::string_view s)
 {
-    return impl::enum_str<E>::get().convert(s);
+    return impl::enum_str<E>::convert(s);
 }
 
 } // namespace soficpp
@@ -12,8 +12,11 @@
 #include <bitset>
 #include <compare>
 #include <concepts>
+#include <cstddef>
+#include <functional>
 #include <memory>
 #include <ostream>
+#include <ranges>
 #include <sstream>
 #include <set>
 #include <type_traits>
@@ -56,6 +59,48 @@ template <class T> concept integrity =
         { i.value() } -> std::same_as<const typename T::value_type&>;
     };
 
+namespace impl {
+
+//! An integrity type that provides an optimized one-directional dominance test
+/*! Member function \c leq(i) must return the same value as <tt>*this <=
+ * i</tt>, but it may be faster, because it need not compute the full
+ * three-way comparison.
+ * \tparam T an integrity type */
+template <class T> concept integrity_leq =
+    requires (const T i1, const T i2) {
+        { i1.leq(i2) } -> std::same_as<bool>;
+    };
+
+} // namespace impl
+
+//! Tests if an integrity is less than or equal to another integrity.
+/*! This is a customization point. It calls member function \c leq() if
+ * provided by type \a T, otherwise it uses operator \c <=. It should be used
+ * instead of \c <= and \c >= for testing dominance of integrities, which is
+ * the most frequent operation of SOFI.
+ * \tparam T an integrity type
+ * \param[in] i1 an integrity
+ * \param[in] i2 an integrity
+ * \return <tt>i1 <= i2</tt> */
+template <class T> bool leq(const T& i1, const T& i2)
+{
+    if constexpr (impl::integrity_leq<T>)
+        return i1.leq(i2);
+    else
+        return i1 <= i2;
+}
+
+//! Tests if an integrity is greater than or equal to another integrity.
+/*! It calls leq() with swapped arguments.
+ * \tparam T an integrity type
+ * \param[in] i1 an integrity
+ * \param[in] i2 an integrity
+ * \return <tt>i1 >= i2</tt> */
+template <class T> bool geq(const T& i1, const T& i2)
+{
+    return leq(i2, i1);
+}
+
 //! The simplest integrity type containing just a single integrity value
 /*! It satisfies concept soficpp::integrity.
  * \test in file test_integrity.cpp */
@@ -84,6 +129,12 @@ public:
      * \param[in] i compared integrity value
      * \return std::strong_ordering */
     constexpr auto operator<=>(const integrity_single& i) const noexcept = default;
+    //! The one-directional dominance test used by soficpp::leq()
+    /*! \param[in] i compared integrity value
+     * \return always \c true */
+    [[nodiscard]] constexpr bool leq([[maybe_unused]] const integrity_single& i) const noexcept {
+        return true;
+    }
     //! The lattice join operation
     /*! \param[in] i an integrity value
      * \return the result of join */
@@ -178,6 +229,12 @@ public:
      * \param[in] i compared integrity value
      * \return std::strong_ordering */
     constexpr auto operator<=>(const integrity_linear& i) const noexcept = default;
+    //! The one-directional dominance test used by soficpp::leq()
+    /*! \param[in] i compared integrity value
+     * \return <tt>*this <= i</tt> */
+    [[nodiscard]] constexpr bool leq(const integrity_linear& i) const noexcept {
+        return val <= i.val;
+    }
     //! The lattice join operation
     /*! \param[in] i an integrity value
      * \return the maximum of the arguments */
@@ -278,6 +335,13 @@ public:
             return std::partial_ordering ::greater; // i is a subset of this
         return std::partial_ordering::unordered; // no one is a subset of the other
     }
+    //! The one-directional dominance test used by soficpp::leq()
+    /*! It tests the subset relation by a single pass over the bits.
+     * \param[in] i compared integrity value
+     * \return whether this integrity is a subset of \a i */
+    [[nodiscard]] bool leq(const integrity_bitset& i) const noexcept {
+        return (val & ~i.val).none();
+    }
     //! The lattice join operation
     /*! \param[in] i an integrity value
      * \return the union of the two sets */
@@ -341,6 +405,14 @@ namespace impl {
 /*! \tparam T a set element type */
 template <class T> concept integrity_set_value = std::regular<T>;
 
+//! A type that may be used as the parameter of template integrity_set with a signature
+/*! \tparam T a set element type */
+template <class T> concept integrity_set_hashable =
+    integrity_set_value<T> &&
+    requires (const T v) {
+        { std::hash<T>{}(v) } -> std::convertible_to<size_t>;
+    };
+
 } // namespace impl
 
 //! An integrity type that uses a set of values as an integrity value
@@ -349,9 +421,25 @@ template <class T> concept integrity_set_value = std::regular<T>;
  * operation join and meet are set union and intersection, respectively. The
  * least element is the empty set. the greatest element is the special value
  * \ref universe, representing a set containing all possible values.
+ *
+ * If \a S is nonzero, each integrity carries a signature, which is a Bloom
+ * filter of \a S bits: each element sets the bit selected by its hash. The
+ * signature is computed when an integrity is created, including the results
+ * of join and meet. The subset test rejects \a a ⊆ \a b without comparing
+ * elements if \a a has a signature bit not present in the signature of \a b.
+ * Otherwise, elements are compared, hence the signature never changes
+ * results. It is useful if most dominance tests fail. If \a S is zero, there
+ * is no signature and no overhead.
+ *
+ * Sets use a transparent comparator, therefore, membership can be tested,
+ * and integrities can be created, using values of any type comparable with
+ * \a T, for example, \c std::string_view for \a T = \c std::string,
+ * without creating temporary objects of type \a T.
  * \tparam T the type of elements of an integrity value
+ * \tparam S the number of bits of the signature, typically 0, 64, or 128
  * \test in file test_integrity.cpp */
-template <impl::integrity_set_value T> class integrity_set {
+template <impl::integrity_set_value T, size_t S = 0> requires (S == 0 || impl::integrity_set_hashable<T>)
+class integrity_set {
 public:
     //! An empty structure representing the maximum integrity of integrity_set
     /*! It is treated as strictly greater than any subset of values of type \a
@@ -366,21 +454,58 @@ public:
     };
     static_assert(universe{} == universe{});
     //! The type of integrity_set values that are not equal to \ref universe
-    using set_t = std::set<T>;
+    using set_t = std::set<T, std::less<>>;
     //! The type used to store the integrity_set value
     using value_type = std::variant<set_t, universe>;
+    //! The type of the signature, empty if \a S is zero
+    using signature_t = std::bitset<S>;
+    //! The type of a tag selecting construction from sorted values
+    struct sorted_unique_t {
+        //! The default constructor
+        explicit sorted_unique_t() = default;
+    };
+    //! A tag selecting construction from sorted values
+    static constexpr sorted_unique_t sorted_unique{};
     //! Default constructor, creates the empty set.
     constexpr integrity_set() = default;
     //! Creates an integrity from a value_type.
     /*! \param[in] value the value of the integrity */
-    explicit integrity_set(value_type value): val(std::move(value)) {}
+    explicit integrity_set(value_type value): val(std::move(value)), sig(make_signature(val)) {}
     //! Creates an integrity from a set_t.
     /*! The created set will have a value different from max().
      * \param[in] value the value of the integrity */
-    explicit integrity_set(set_t value): val(std::move(value)) {}
+    explicit integrity_set(set_t value): val(std::move(value)), sig(make_signature(val)) {}
     //! Creates an integrity equal to max()
     /*! \param[in] value the \ref universe value */
-    explicit integrity_set(universe value): val(value) {}
+    explicit integrity_set(universe value): val(value), sig(make_signature(val)) {}
+    //! Creates an integrity from a range of values in any order.
+    /*! Each element of type \a T is constructed directly in the set from a
+     * value of \a r, duplicate values are ignored.
+     * \tparam R a range of values convertible to \a T, for example, \c
+     * std::string_view
+     * \param[in] r the elements of the integrity */
+    template <std::ranges::input_range R> requires
+        std::constructible_from<T, std::ranges::range_reference_t<R>> &&
+        (!std::same_as<std::remove_cvref_t<R>, set_t>)
+    explicit integrity_set(R&& r) {
+        auto& elems = std::get<set_t>(val);
+        for (auto&& v: r)
+            elems.emplace(std::forward<decltype(v)>(v));
+        sig = make_signature(val);
+    }
+    //! Creates an integrity from a range of sorted values in linear time.
+    /*! Values must be in strictly ascending order. If they are not, the
+     * created integrity is still correct, but the construction is slower.
+     * \tparam R a range of values convertible to \a T, for example, \c
+     * std::string_view
+     * \param[in] r the elements of the integrity */
+    template <std::ranges::input_range R> requires std::constructible_from<T, std::ranges::range_reference_t<R>>
+    integrity_set(sorted_unique_t, R&& r) {
+        auto& elems = std::get<set_t>(val);
+        for (auto&& v: r)
+            elems.emplace_hint(elems.end(), std::forward<decltype(v)>(v));
+        sig = make_signature(val);
+    }
     //! Compares the sets for equality.
     /*! The inequality operator is automatically generated.
      * \param[in] i compared integrity value
@@ -392,7 +517,7 @@ public:
         else if (std::holds_alternative<universe>(i.val))
             return false;
         else
-            return std::get<set_t>(val) == std::get<set_t>(i.val);
+            return sig == i.sig && std::get<set_t>(val) == std::get<set_t>(i.val);
     }
     //! Checks if one integrity is a subset of the other.
     /*! Value \ref universe is treated as equal to itself and a proper superset
@@ -408,33 +533,43 @@ public:
         } else if (std::holds_alternative<universe>(i.val))
             return std::partial_ordering::less;
         else {
+            // A set can be a subset only of a set of the same or greater size
             const auto& v_set = std::get<set_t>(val);
             const auto& i_set = std::get<set_t>(i.val);
-            bool v_subset_of_i = true;
-            bool i_subset_of_v = true;
-            for (const auto& v: v_set)
-                if (!i_set.contains(v)) {
-                    v_subset_of_i = false;
-                    break;
-                }
-            for (const auto& i: i_set)
-                if (!v_set.contains(i)) {
-                    i_subset_of_v = false;
-                    break;
-                }
-            if (v_subset_of_i) {
-                if (i_subset_of_v)
-                    return std::partial_ordering::equivalent;
-                else
-                    return std::partial_ordering::less;
-            } else {
-                if (i_subset_of_v)
-                    return std::partial_ordering::greater;
-                else
-                    return std::partial_ordering::unordered;
-            }
+            if (v_set.size() < i_set.size())
+                return subset(*this, i) ? std::partial_ordering::less : std::partial_ordering::unordered;
+            else if (v_set.size() > i_set.size())
+                return subset(i, *this) ? std::partial_ordering::greater : std::partial_ordering::unordered;
+            else
+                return *this == i ? std::partial_ordering::equivalent : std::partial_ordering::unordered;
         }
     }
+    //! Tests membership of a value.
+    /*! \tparam K a type comparable with \a T, for example, \c
+     * std::string_view
+     * \param[in] v a value
+     * \return whether \a v is an element of this integrity, always \c true
+     * for \ref universe */
+    template <class K> requires requires (const set_t s, const K v) { s.contains(v); }
+    [[nodiscard]] bool contains(const K& v) const {
+        if (auto p = std::get_if<set_t>(&val))
+            return p->contains(v);
+        return true;
+    }
+    //! The one-directional dominance test used by soficpp::leq()
+    /*! Value \ref universe is treated as equal to itself and a proper superset
+     * of any set_t. Sets are compared by a single pass, which is skipped if
+     * this set is larger than \a i or if the signatures exclude the subset
+     * relation.
+     * \param[in] i compared integrity value
+     * \return whether this integrity is a subset of \a i */
+    [[nodiscard]] bool leq(const integrity_set& i) const {
+        if (std::holds_alternative<universe>(i.val))
+            return true;
+        if (std::holds_alternative<universe>(val))
+            return false;
+        return subset(*this, i);
+    }
     //! The lattice join operation
     /*! The join of \ref universe with anything is \ref universe.
      * \param[in] i an integrity value
@@ -448,6 +583,7 @@ public:
             r.insert(v);
         for (const auto& i: std::get<set_t>(i.val))
             r.insert(i);
+        result.sig = sig | i.sig;
         return result;
     }
     //! The lattice meet operation
@@ -460,6 +596,10 @@ public:
         if (std::holds_alternative<universe>(i.val))
             return *this;
         integrity_set result{};
+        // Sets with disjoint signatures have no common element
+        if constexpr (S > 0)
+            if ((sig & i.sig).none())
+                return result;
         auto& r = std::get<set_t>(result.val);
         const auto& v_set = std::get<set_t>(val);
         const auto& i_set = std::get<set_t>(i.val);
@@ -467,8 +607,10 @@ public:
         const auto& set2 = v_set.size() < i_set.size() ? i_set : v_set;
         // interate over the smaller set in O(n), test membership in the greater set in O(log(n))
         for (const auto& v: set1)
-            if (set2.contains(v))
-                r.insert(v);
+            if (set2.contains(v)) {
+                r.insert(r.end(), v);
+                result.sig |= element_signature(v);
+            }
         return result;
     }
     //! The lattice minimum
@@ -486,6 +628,11 @@ public:
     [[nodiscard]] constexpr const value_type& value() const noexcept {
         return val;
     }
+    //! Gets the signature
+    /*! \return the signature, all bits set for \ref universe */
+    [[nodiscard]] const signature_t& signature() const noexcept {
+        return sig;
+    }
     //! Converts the value to a string.
     /*! It uses stream operator \c << for creating strings from set values.
      * \return a comma-separated list of string representations of individual
@@ -497,8 +644,50 @@ public:
         return os.str();
     }
 private:
+    //! Tests the subset relation.
+    /*! It walks both sets in parallel, therefore, it is linear in the sizes
+     * of the sets. It returns immediately if \a i1 is larger than \a i2 or
+     * if the signature of \a i1 is not a subset of the signature of \a i2.
+     * \param[in] i1 an integrity, not \ref universe
+     * \param[in] i2 an integrity, not \ref universe
+     * \return whether \a i1 is a subset of \a i2 */
+    static bool subset(const integrity_set& i1, const integrity_set& i2) {
+        const auto& s1 = std::get<set_t>(i1.val);
+        const auto& s2 = std::get<set_t>(i2.val);
+        if (s1.size() > s2.size())
+            return false;
+        if constexpr (S > 0)
+            if ((i1.sig & ~i2.sig).any())
+                return false;
+        return std::includes(s2.begin(), s2.end(), s1.begin(), s1.end());
+    }
+    //! Computes the signature bit of an element.
+    /*! \param[in] v an element
+     * \return the signature of the set containing only \a v */
+    static signature_t element_signature([[maybe_unused]] const T& v) {
+        signature_t result{};
+        if constexpr (S > 0)
+            result.set(std::hash<T>{}(v) % S);
+        return result;
+    }
+    //! Computes the signature of a value.
+    /*! \param[in] v a value
+     * \return the signature of \a v */
+    static signature_t make_signature([[maybe_unused]] const value_type& v) {
+        signature_t result{};
+        if constexpr (S > 0) {
+            if (std::holds_alternative<universe>(v))
+                result.set();
+            else
+                for (const auto& e: std::get<set_t>(v))
+                    result |= element_signature(e);
+        }
+        return result;
+    }
     //! The value of this integrity
     value_type val{};
+    //! The signature of \ref val, occupies no space if \a S is zero
+    [[no_unique_address]] signature_t sig{};
     //! Output of a value_type value
     /*! \param[in] os an output stream
      * \param[in] val a value
@@ -531,6 +720,7 @@ private:
 };
 
 static_assert(integrity<integrity_set<std::string>>);
+static_assert(integrity<integrity_set<std::string, 64>>);
 
 //! An integrity type that holds another integrity type and shares it when copied
 /*! It satisfies concept soficpp::integrity.
@@ -576,6 +766,15 @@ public:
     auto operator<=>(const integrity_shared& i) const {
         return *val <=> *i.val;
     }
+    //! The one-directional dominance test used by soficpp::leq()
+    /*! It returns \c true without comparing if both objects share the same
+     * internal object, otherwise it calls soficpp::leq() for the internal
+     * objects.
+     * \param[in] i compared integrity value
+     * \return <tt>*this <= i</tt> */
+    [[nodiscard]] bool leq(const integrity_shared& i) const {
+        return val == i.val || soficpp::leq(*val, *i.val);
+    }
     //! The lattice join operation
     /*! It computes the join of the internal objects. If the result is the same
      * as one of its arguments, it shares the internal object with that
@@ -4,9 +4,13 @@
 
 #include "sqlite_cpp.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
+#include <list>
+#include <random>
 #include <sqlite3.h>
+#include <unordered_map>
 #include <utility>
 
 namespace sqlite {
@@ -16,6 +20,26 @@ namespace sqlite {
 // classes is different here, because query::impl needs connection and
 // connection::impl to be already complete types.
 
+/*** retry_policy ************************************************************/
+
+std::chrono::microseconds retry_policy::delay(uint32_t retry) const
+{
+    thread_local std::minstd_rand rng{std::random_device{}()};
+    auto limit = initial_delay;
+    for (; retry > 0 && limit < max_delay; --retry)
+        limit *= 2;
+    limit = std::min(limit, max_delay);
+    if (limit.count() <= 0)
+        return std::chrono::microseconds{0};
+    return std::chrono::microseconds{
+        std::uniform_int_distribution<std::chrono::microseconds::rep>{0, limit.count()}(rng)};
+}
+
+void retry_policy::wait(uint32_t retry) const
+{
+    std::this_thread::sleep_for(delay(retry));
+}
+
 /*** connection::impl ********************************************************/
 
 //! Internal implementation class for sqlite::connection
@@ -23,8 +47,9 @@ class connection::impl {
 public:
     //! Creates a new database connection.
     /*! \param[in] conn the related interface object
-     * \param[in] create whether to create the database if it does not exist */
-    explicit impl(connection& conn, bool create);
+     * \param[in] create whether to create the database if it does not exist
+     * \param[in] opts options of the connection */
+    explicit impl(connection& conn, bool create, const options& opts);
     //! No copy
     impl(const impl&) = delete;
     //! No move
@@ -41,7 +66,7 @@ public:
     sqlite3* db = nullptr;
 };
 
-connection::impl::impl(connection& conn, bool create): conn(conn)
+connection::impl::impl(connection& conn, bool create, const options& opts): conn(conn)
 {
     if (int status = sqlite3_open_v2(conn._file.c_str(), &db,
                                      (create ? SQLITE_OPEN_CREATE : 0U) |
@@ -57,9 +82,40 @@ connection::impl::impl(connection& conn, bool create): conn(conn)
             throw error("sqlite3_open_v2", conn._file);
         throw error("sqlite3_open_v2", conn, *this);
     }
-    if (int status = sqlite3_exec(db, "pragma synchronous = normal", nullptr,
-                                  nullptr, nullptr);
-        status != SQLITE_OK)
+    // Locking mode must be set before the first access to a database in WAL mode
+    std::string pragmas = opts.exclusive ? "pragma locking_mode = exclusive;" : "";
+    pragmas += "pragma synchronous = ";
+    switch (opts.synchronous) {
+    case options::synchronous_t::off:
+        pragmas += "off;";
+        break;
+    case options::synchronous_t::normal:
+    default:
+        pragmas += "normal;";
+        break;
+    case options::synchronous_t::full:
+        pragmas += "full;";
+        break;
+    case options::synchronous_t::extra:
+        pragmas += "extra;";
+        break;
+    }
+    auto pragma_int = [&pragmas](std::string_view name, const std::optional<int64_t>& v) {
+        if (v) {
+            pragmas += "pragma ";
+            pragmas += name;
+            pragmas += " = ";
+            pragmas += std::to_string(*v);
+            pragmas += ';';
+        }
+    };
+    pragma_int("mmap_size", opts.mmap_size);
+    pragma_int("cache_size", opts.cache_size);
+    if (opts.temp_store)
+        pragma_int("temp_store", int64_t(*opts.temp_store));
+    pragma_int("wal_autocheckpoint", opts.wal_autocheckpoint);
+    pragma_int("journal_size_limit", opts.journal_size_limit);
+    if (int status = sqlite3_exec(db, pragmas.c_str(), nullptr, nullptr, nullptr); status != SQLITE_OK)
     {
         throw error("sqlite3_exec(pragma)", conn, *this);
     }
@@ -74,16 +130,128 @@ connection::impl::~impl()
     }
 }
 
+/*** connection::cache *******************************************************/
+
+//! The cache of prepared queries of a sqlite::connection
+/*! Queries are kept in a list ordered from the most recently used, with an
+ * index by SQL texts. A query leased by connection::cached() is removed from
+ * the cache until the lease is destroyed. */
+class connection::cache {
+public:
+    //! Creates an empty cache.
+    /*! \param[in] capacity the maximum number of queries in the cache */
+    explicit cache(size_t capacity): capacity(capacity) {}
+    //! Removes a query from the cache.
+    /*! \param[in] sql the SQL text of the query
+     * \return the query, \c nullptr if not found */
+    std::unique_ptr<query> take(const std::string& sql);
+    //! Inserts a query to the cache as the most recently used.
+    /*! If the cache already contains a query with the same SQL text, \a q is
+     * destroyed.
+     * \param[in] q a query */
+    void put(std::unique_ptr<query> q);
+    //! Destroys the least recently used queries if the cache is over capacity.
+    void trim();
+    //! The maximum number of queries in the cache
+    size_t capacity;
+private:
+    //! Queries, from the most recently used
+    std::list<std::unique_ptr<query>> lru{};
+    //! Index of \ref lru by SQL texts, the keys refer to query::sql() of the values
+    std::unordered_map<std::string_view, decltype(lru)::iterator> index{};
+};
+
+std::unique_ptr<query> connection::cache::take(const std::string& sql)
+{
+    auto it = index.find(sql);
+    if (it == index.end())
+        return nullptr;
+    auto q = std::move(*it->second);
+    lru.erase(it->second);
+    index.erase(it);
+    return q;
+}
+
+void connection::cache::put(std::unique_ptr<query> q)
+{
+    if (capacity == 0 || index.contains(q->sql()))
+        return;
+    lru.push_front(std::move(q));
+    index.emplace(lru.front()->sql(), lru.begin());
+    trim();
+}
+
+void connection::cache::trim()
+{
+    while (lru.size() > capacity) {
+        index.erase(lru.back()->sql());
+        lru.pop_back();
+    }
+}
+
+/*** connection::options *****************************************************/
+
+namespace {
+
+using namespace std::chrono_literals;
+
+//! Named presets of connection options
+const std::pair<std::string_view, connection::options> option_presets[] = {
+    {"default", {}},
+    {"bulk_load", {
+        .synchronous = connection::options::synchronous_t::off,
+        .mmap_size = 256 << 20,
+        .cache_size = -(256 << 10),
+        .temp_store = connection::options::temp_store_t::memory,
+        .wal_autocheckpoint = 0,
+        .journal_size_limit = 64 << 20,
+        .exclusive = true,
+    }},
+    {"oltp", {
+        .synchronous = connection::options::synchronous_t::normal,
+        .mmap_size = 256 << 20,
+        .cache_size = -(64 << 10),
+        .temp_store = connection::options::temp_store_t::memory,
+        .wal_autocheckpoint = 1000,
+        .journal_size_limit = 64 << 20,
+        .exclusive = false,
+        .retry = retry_policy{.max_retries = 20, .initial_delay = 100us, .max_delay = 10ms},
+    }},
+};
+
+} // namespace
+
+auto connection::options::preset(std::string_view name) -> const options*
+{
+    for (auto&& p: option_presets)
+        if (p.first == name)
+            return &p.second;
+    return nullptr;
+}
+
+std::vector<std::string_view> connection::options::preset_names()
+{
+    std::vector<std::string_view> names{};
+    for (auto&& p: option_presets)
+        names.push_back(p.first);
+    return names;
+}
+
 /*** connection **************************************************************/
 
-connection::connection(std::string file, bool create):
-    _file(std::move(file)), _impl(std::make_unique<impl>(*this, create)),
+connection::connection(std::string file, bool create, const options& opts):
+    _file(std::move(file)), _impl(std::make_unique<impl>(*this, create, opts)),
+    _cache(std::make_unique<cache>(default_cache_capacity)),
     _transaction_begin_deferred(*this, "begin deferred transaction"),
     _transaction_begin_immediate(*this, "begin immediate transaction"),
     _transaction_begin_exclusive(*this, "begin exclusive transaction"),
     _transaction_commit(*this, "commit transaction"),
     _transaction_rollback(*this, "rollback transaction")
 {
+    if (opts.busy_timeout)
+        busy_timeout(*opts.busy_timeout);
+    if (opts.retry)
+        retry(*opts.retry);
 }
 
 connection::~connection() = default;
@@ -94,6 +262,92 @@ void connection::interrupt()
         sqlite3_interrupt(_impl->db);
 }
 
+void connection::busy_timeout(std::chrono::milliseconds timeout)
+{
+    if (sqlite3_busy_timeout(_impl->db, int(timeout.count())) != SQLITE_OK)
+        throw error("sqlite3_busy_timeout", *this);
+}
+
+void connection::retry(const retry_policy& policy)
+{
+    _retry = policy;
+    auto handler = [](void* arg, int n) -> int {
+        auto& p = *static_cast<const retry_policy*>(arg);
+        if (n < 0 || uint32_t(n) >= p.max_retries)
+            return 0;
+        p.wait(uint32_t(n));
+        return 1;
+    };
+    if (sqlite3_busy_handler(_impl->db, handler, &_retry) != SQLITE_OK)
+        throw error("sqlite3_busy_handler", *this);
+}
+
+query_lease connection::cached(std::string sql)
+{
+    auto q = _cache->take(sql);
+    if (!q)
+        q = std::make_unique<query>(*this, std::move(sql));
+    return query_lease{*this, std::move(q)};
+}
+
+void connection::cache_capacity(size_t capacity)
+{
+    _cache->capacity = capacity;
+    _cache->trim();
+}
+
+/*** pool ********************************************************************/
+
+pool::pool(std::string file, connection::options opts):
+    _file(std::move(file)), _options(std::move(opts))
+{
+    if (!_options.busy_timeout && !_options.retry)
+        _options.retry = retry_policy{};
+    _writer = std::make_unique<connection>(_file, false, _options);
+    query q{*_writer, "pragma journal_mode = wal"};
+    q.start().next_row();
+}
+
+pool::~pool() = default;
+
+connection& pool::reader()
+{
+    if (_options.exclusive)
+        return *_writer;
+    std::lock_guard lck{_readers_mtx};
+    auto& c = _readers[std::this_thread::get_id()];
+    if (!c) {
+        auto r = std::make_unique<connection>(_file, false, _options);
+        query{*r, "pragma query_only = 1"}.start().next_row();
+        c = std::move(r);
+    }
+    return *c;
+}
+
+void pool::release_reader()
+{
+    std::unique_ptr<connection> c{};
+    std::lock_guard lck{_readers_mtx};
+    if (auto it = _readers.find(std::this_thread::get_id()); it != _readers.end()) {
+        c = std::move(it->second);
+        _readers.erase(it);
+    }
+}
+
+/*** query_lease *************************************************************/
+
+query_lease::~query_lease()
+{
+    if (!_q)
+        return;
+    try {
+        _q->start();
+        _db->_cache->put(std::move(_q));
+    } catch (...) {
+        // The query is destroyed and will be prepared again if needed
+    }
+}
+
 /*** query::impl *************************************************************/
 
 //! Internal implementation class for sqlite::query
@@ -197,6 +451,13 @@ query& query::bind(int i, const blob_t& v)
     return *this;
 }
 
+query& query::bind(int i, std::span<const unsigned char> v)
+{
+    if (sqlite3_bind_blob(_impl->stmt, i, v.data(), int(v.size()), SQLITE_STATIC) != SQLITE_OK)
+        throw error("sqlite3_bind_blob", _db, _sql);
+    return *this;
+}
+
 int query::column_count()
 {
     return sqlite3_column_count(_impl->stmt);
@@ -223,6 +484,51 @@ query::column_value query::get_column(int i)
     }
 }
 
+query::column_type query::get_column_type(int i)
+{
+    switch (sqlite3_column_type(_impl->stmt, i)) {
+    case SQLITE_NULL:
+    default:
+        return column_type::ct_null;
+    case SQLITE_INTEGER:
+        return column_type::ct_int64;
+    case SQLITE_FLOAT:
+        return column_type::ct_double;
+    case SQLITE_TEXT:
+        return column_type::ct_string;
+    case SQLITE_BLOB:
+        return column_type::ct_blob;
+    }
+}
+
+int64_t query::get_int64(int i)
+{
+    return sqlite3_column_int64(_impl->stmt, i);
+}
+
+double query::get_double(int i)
+{
+    return sqlite3_column_double(_impl->stmt, i);
+}
+
+std::string_view query::get_text(int i)
+{
+    // sqlite3_column_bytes() must be called after sqlite3_column_text()
+    auto p = reinterpret_cast<const char*>(sqlite3_column_text(_impl->stmt, i));
+    if (!p)
+        return {};
+    return {p, size_t(sqlite3_column_bytes(_impl->stmt, i))};
+}
+
+std::span<const unsigned char> query::get_blob(int i)
+{
+    // sqlite3_column_bytes() must be called after sqlite3_column_blob()
+    auto p = reinterpret_cast<const unsigned char*>(sqlite3_column_blob(_impl->stmt, i));
+    if (!p)
+        return {};
+    return {p, size_t(sqlite3_column_bytes(_impl->stmt, i))};
+}
+
 query::status query::next_row(uint32_t retries)
 {
     switch (auto status = sqlite3_step(_impl->stmt); status % 256) {
@@ -234,7 +540,7 @@ query::status query::next_row(uint32_t retries)
     case SQLITE_LOCKED:
         if (retries > 0)
             return status::locked;
-        [[fallthrough]];
+        throw busy_error("sqlite3_step", _db, _sql);
     default:
         throw error("sqlite3_step", _db, _sql);
     }
@@ -282,9 +588,9 @@ void transaction::commit()
 {
     if (_finished)
         return;
-    _finished = true;
     auto r = _db._transaction_commit.start().next_row();
     assert(r == query::status::done);
+    _finished = true;
 }
 
 void transaction::rollback()
@@ -316,4 +622,10 @@ error::error(const std::string& fun, connection& db, connection::impl& impl):
 {
 }
 
+type_error::type_error(connection& db, const std::string& sql, int i):
+        error("sqlite3 error in db \"" + db._file + "\": Unexpected type of column " + std::to_string(i) +
+              "\nquery:\n" + sql)
+{
+}
+
 } // namespace sqlite
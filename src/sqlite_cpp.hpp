@@ -4,10 +4,25 @@
  * \brief Interface to database SQLite 3
  */
 
+#include <cassert>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <span>
 #include <stdexcept>
+#include <string>
 #include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -28,21 +43,76 @@
  * an internal implementation object */
 namespace sqlite {
 
+class busy_error;
 class connection;
+class pool;
 class query;
+class query_lease;
 class transaction;
 
 //! The type used for blob values
 /*! \note It must a different type than \c std::string. */
 using blob_t = std::vector<unsigned char>;
 
+namespace impl {
+
+//! Checks if a type is an instance of \c std::optional
+/*! \tparam T a type */
+template <class T> inline constexpr bool is_optional = false;
+
+//! Checks if a type is an instance of \c std::optional
+/*! \tparam T a type */
+template <class T> inline constexpr bool is_optional<std::optional<T>> = true;
+
+} // namespace impl
+
+//! Types of non-null column values that can be obtained by query::get()
+/*! \tparam T a type */
+template <class T> concept column_value_type =
+    std::is_same_v<T, int64_t> || std::is_same_v<T, double> ||
+    std::is_same_v<T, std::string_view> || std::is_same_v<T, std::string> ||
+    std::is_same_v<T, std::span<const unsigned char>> || std::is_same_v<T, blob_t>;
+
+//! Types of column values that can be obtained by query::get()
+/*! It is a column_value_type, or \c std::optional of a column_value_type,
+ * which also accepts \c NULL values.
+ * \tparam T a type */
+template <class T> concept column_result_type =
+    column_value_type<T> || (impl::is_optional<T> && column_value_type<typename T::value_type>);
+
+//! A policy of retrying operations on a busy (locked) database
+/*! Delays between retries grow exponentially from \ref initial_delay up to
+ * \ref max_delay. The actual delay is chosen randomly between zero and the
+ * computed value (full jitter), so that concurrent connections waiting for the
+ * same lock do not retry at the same time. */
+struct retry_policy {
+    //! The maximum number of retries, 0 disables retrying
+    uint32_t max_retries = 10;
+    //! The upper bound of the delay before the first retry
+    std::chrono::microseconds initial_delay{1000};
+    //! The upper bound of the delay before any retry
+    std::chrono::microseconds max_delay{100000};
+    //! Computes a delay before a retry.
+    /*! \param[in] retry the number of retries done so far
+     * \return a random delay before the next retry */
+    [[nodiscard]] std::chrono::microseconds delay(uint32_t retry) const;
+    //! Waits before a retry.
+    /*! \param[in] retry the number of retries done so far */
+    void wait(uint32_t retry) const;
+};
+
 //! A prepared SQLite query
 /*! The query object can be executed multiple times. Before each execution,
  * function start() must be called. Then, if the query has any parameters, they
  * are assigned values by repeatedly calling a bind() or bind_blob() function.
  * The query is executed and rows of the query result are obtained by
  * repeatedly calling next_row(). Column values are extracted from a row by
- * get_column(), with column_count() returning the number of columns. */
+ * get_column(), with column_count() returning the number of columns. Typed
+ * accessors get_int64(), get_double(), get_text(), and get_blob() extract
+ * values without constructing a column_value, and the latter two also without
+ * copying the value. Template functions get(), row(), and rows() extract
+ * values of types selected at compile time, and bind_all() binds all
+ * parameters at once. */
 class query {
 public:
     //! Supported data types of database values and columns
@@ -133,6 +203,36 @@ public:
      * \param[in] v the parameter value
      * \return \c *this */
     query& bind(int i, const blob_t& v);
+    //! Binds a query parameter to a blob view value
+    /*! \param[in] i parameter index (starting from 1)
+     * \param[in] v the parameter value
+     * \return \c *this */
+    query& bind(int i, std::span<const unsigned char> v);
+    //! Binds a query parameter to an optional value
+    /*! \tparam T a type accepted by another overload of bind()
+     * \param[in] i parameter index (starting from 1)
+     * \param[in] v the parameter value, \c std::nullopt is bound as \c NULL
+     * \return \c *this */
+    template <class T> query& bind(int i, const std::optional<T>& v) {
+        if (v)
+            return bind(i, *v);
+        else
+            return bind(i, nullptr);
+    }
+    //! Binds all query parameters.
+    /*! \tparam T types accepted by bind()
+     * \param[in] v the parameter values, bound to parameters 1, 2, ...
+     * \return \c *this */
+    template <class... T> query& bind_all(const T&... v) {
+        int i = 0;
+        (bind(++i, v), ...);
+        return *this;
+    }
+    //! Gets the SQL text of the query.
+    /*! \return the SQL text passed to the constructor */
+    [[nodiscard]] const std::string& sql() const noexcept {
+        return _sql;
+    }
     //! Gets the number of columns in the query result.
     /*! \return the number of columns */
     int column_count();
@@ -142,7 +242,7 @@ public:
      * more rows by returning status::done. If the database is locked, that is,
      * the low-level API function returns \c SQLITE_ROW or \c SQLITE_LOCKED,
      * the behavior is controlled by parameter \a retries. If \a retries is 0,
-     * then sqlite::error is thrown. Otherwise, status::locked is returned and
+     * then sqlite::busy_error is thrown. Otherwise, status::locked is returned and
      * the caller should decrement \a retries, restart the query by \c
      * start(true), and begin repeating calls to next_row() again.
      * \param[in] retries the number of planned retries after detecting a
@@ -155,6 +255,81 @@ public:
      * <tt>column_count()-1</tt>, inclusive
      * \return the column value */
     column_value get_column(int i);
+    //! Gets the type of a column value from a row returned by the query
+    /*! \param[in] i column index (starting from 0); must be between 0 and
+     * <tt>column_count()-1</tt>, inclusive
+     * \return the type of the column value */
+    column_type get_column_type(int i);
+    //! Gets an integer column value from a row returned by the query
+    /*! Unlike get_column(), it does not construct a column_value. A value of
+     * another type is converted to an integer as defined by SQLite function
+     * \c sqlite3_column_int64().
+     * \param[in] i column index (starting from 0); must be between 0 and
+     * <tt>column_count()-1</tt>, inclusive
+     * \return the column value */
+    int64_t get_int64(int i);
+    //! Gets a floating point column value from a row returned by the query
+    /*! Unlike get_column(), it does not construct a column_value. A value of
+     * another type is converted to a floating point value as defined by SQLite
+     * function \c sqlite3_column_double().
+     * \param[in] i column index (starting from 0); must be between 0 and
+     * <tt>column_count()-1</tt>, inclusive
+     * \return the column value */
+    double get_double(int i);
+    //! Gets a text column value from a row returned by the query without copying
+    /*! Unlike get_column(), it does not construct a column_value. A value of
+     * another type is converted to a text as defined by SQLite function \c
+     * sqlite3_column_text(); \c NULL is converted to an empty string.
+     * \param[in] i column index (starting from 0); must be between 0 and
+     * <tt>column_count()-1</tt>, inclusive
+     * \return the column value, valid until the next call of next_row() or
+     * start(), or until this query is destroyed */
+    std::string_view get_text(int i);
+    //! Gets a blob column value from a row returned by the query without copying
+    /*! Unlike get_column(), it does not construct a column_value. A value of
+     * another type is converted to a blob as defined by SQLite function \c
+     * sqlite3_column_blob(); \c NULL is converted to an empty blob.
+     * \param[in] i column index (starting from 0); must be between 0 and
+     * <tt>column_count()-1</tt>, inclusive
+     * \return the column value, valid until the next call of next_row() or
+     * start(), or until this query is destroyed */
+    std::span<const unsigned char> get_blob(int i);
+    //! Gets a typed column value from a row returned by the query
+    /*! The type of the value must match \a T: \c int64_t for an integer, \c
+     * double for a floating point value, \c std::string_view or \c std::string
+     * for a text, and <tt>std::span<const unsigned char></tt> or \ref blob_t
+     * for a blob. A \c NULL value is accepted only if \a T is \c
+     * std::optional. Views are valid as described for get_text() and
+     * get_blob().
+     * \tparam T the type of the value
+     * \param[in] i column index (starting from 0); must be between 0 and
+     * <tt>column_count()-1</tt>, inclusive
+     * \return the column value
+     * \throw type_error if the value has a different type */
+    template <column_result_type T> T get(int i);
+    //! Gets typed values of the first columns of a row returned by the query
+    /*! \tparam T the types of values, as in get()
+     * \return the values of columns <tt>0, ..., sizeof...(T)-1</tt>
+     * \throw type_error if a value has a different type */
+    template <column_result_type... T> std::tuple<T...> row() {
+        assert(column_count() >= int(sizeof...(T)));
+        return [this]<size_t... I>(std::index_sequence<I...>) {
+            return std::tuple<T...>{get<T>(int(I))...};
+        }(std::index_sequence_for<T...>{});
+    }
+    //! A range of rows returned by rows()
+    /*! \tparam T the types of values in each row */
+    template <column_result_type... T> class row_range;
+    //! Gets all remaining rows of the query result.
+    /*! The query must be started by start() and its parameters bound. Each
+     * step of the returned range calls next_row(), hence the range can be
+     * iterated only once.
+     * \tparam T the types of values, as in row()
+     * \return the range of rows, each of them obtained by row()
+     * \throw type_error if a value has a different type */
+    template <column_result_type... T> row_range<T...> rows() {
+        return row_range<T...>{*this};
+    }
 private:
     class impl;
     connection& _db; //!< The database connection owning this prepared statement
@@ -162,16 +337,119 @@ private:
     std::unique_ptr<impl> _impl; //!< Internal implementation object (PIMPL)
 };
 
+//! A prepared query leased from the cache of prepared queries of a connection
+/*! It is obtained by connection::cached(). The query is returned to the cache
+ * when the lease is destroyed. A lease must be destroyed before the connection
+ * that created it. */
+class query_lease {
+public:
+    //! Default move
+    query_lease(query_lease&&) noexcept = default;
+    //! Returns the query to the cache.
+    ~query_lease();
+    //! No copy
+    query_lease(const query_lease&) = delete;
+    //! No copy
+    query_lease& operator=(const query_lease&) = delete;
+    //! No move
+    query_lease& operator=(query_lease&&) = delete;
+    //! Accesses the leased query.
+    /*! \return the query */
+    query& operator*() const noexcept {
+        return *_q;
+    }
+    //! Accesses the leased query.
+    /*! \return the query */
+    query* operator->() const noexcept {
+        return _q.get();
+    }
+private:
+    //! Creates the lease.
+    /*! \param[in] db the connection owning the cache
+     * \param[in] q the leased query */
+    query_lease(connection& db, std::unique_ptr<query> q) noexcept: _db(&db), _q(std::move(q)) {}
+    connection* _db; //!< The connection owning the cache
+    std::unique_ptr<query> _q; //!< The leased query, \c nullptr if moved from
+    friend class connection;
+};
+
 //! A connection to a SQLite database
+/*! The connection contains a cache of prepared queries indexed by SQL texts.
+ * If a query is executed repeatedly, but it is not convenient to keep a query
+ * object, it can be obtained from the cache by cached(), so that it is not
+ * prepared again for each execution. */
 class connection {
 public:
-    //! Creates a new database connection.
+    //! Options of a connection
+    /*! Most options are set by \c PRAGMA statements when a connection is
+     * opened, see https://sqlite.org/pragma.html. An option with value \c
+     * std::nullopt keeps the SQLite default. Named sets of options suitable for
+     * typical workloads are available by preset(). */
+    struct options {
+        //! Values of <tt>PRAGMA synchronous</tt>
+        enum class synchronous_t {
+            off, //!< No syncing, fastest, the database can be corrupted by an OS crash
+            normal, //!< Sync at critical moments, durable in WAL mode except the last transactions
+            full, //!< Sync after each transaction
+            extra, //!< Like full, and also sync the directory after deleting a rollback journal
+        };
+        //! Values of <tt>PRAGMA temp_store</tt>
+        enum class temp_store_t {
+            default_store, //!< Use the compile-time default
+            file, //!< Store temporary tables and indices in files
+            memory, //!< Store temporary tables and indices in memory
+        };
+        //! <tt>PRAGMA synchronous</tt>
+        synchronous_t synchronous = synchronous_t::normal;
+        //! <tt>PRAGMA mmap_size</tt>, the maximum size of memory-mapped I/O in bytes, 0 disables it
+        std::optional<int64_t> mmap_size{};
+        //! <tt>PRAGMA cache_size</tt>, the page cache size in pages if positive, or in KiB if negative
+        std::optional<int64_t> cache_size{};
+        //! <tt>PRAGMA temp_store</tt>
+        std::optional<temp_store_t> temp_store{};
+        //! <tt>PRAGMA wal_autocheckpoint</tt>, in pages, 0 disables automatic checkpoints
+        std::optional<int64_t> wal_autocheckpoint{};
+        //! <tt>PRAGMA journal_size_limit</tt>, in bytes, negative for no limit
+        std::optional<int64_t> journal_size_limit{};
+        //! <tt>PRAGMA locking_mode = exclusive</tt>, locks are not released until the connection is closed
+        bool exclusive = false;
+        //! Waiting for a busy database by busy_timeout()
+        std::optional<std::chrono::milliseconds> busy_timeout{};
+        //! Waiting for a busy database by retry(), it replaces \ref busy_timeout
+        std::optional<retry_policy> retry{};
+        //! Gets a named preset of options.
+        /*! The available presets are:
+         * \arg \c default -- SQLite defaults, except <tt>synchronous =
+         * normal</tt>
+         * \arg \c bulk_load -- a single connection writing a lot of data:
+         * exclusive locking, no syncing, no automatic checkpoints, large
+         * memory-mapped I/O and page cache, temporary storage in memory;
+         * in WAL mode, it fails if any other connection has the database open
+         * \arg \c oltp -- low-latency short transactions of concurrent
+         * connections: large memory-mapped I/O for fast reads, a moderate
+         * page cache, frequent checkpoints with a limited WAL size, temporary
+         * storage in memory, retrying with short delays
+         * \param[in] name the name of a preset
+         * \return the preset, \c nullptr if \a name is unknown */
+        static const options* preset(std::string_view name);
+        //! Gets names of all presets available by preset().
+        /*! \return the names */
+        static std::vector<std::string_view> preset_names();
+    };
+    //! Creates a new database connection with default options.
     /*! \param[in] file a database file name
      * \param[in] create whether to create the database if it does not exist
      * \throw error if the database does not exist and \a create is \c false
      * \note We are not using \c std::string_view, because sqlite3 requires
      * null-terminated strings. */
-    explicit connection(std::string file, bool create);
+    explicit connection(std::string file, bool create):
+        connection(std::move(file), create, options{}) {}
+    //! Creates a new database connection.
+    /*! \param[in] file a database file name
+     * \param[in] create whether to create the database if it does not exist
+     * \param[in] opts options of the connection
+     * \throw error if the database does not exist and \a create is \c false */
+    connection(std::string file, bool create, const options& opts);
     //! No copy
     connection(const connection&) = delete;
     //! No move
@@ -185,10 +463,46 @@ public:
     //! Aborts any pending database operation.
     /*! \threadsafe{safe, safe} */
     void interrupt();
+    //! Sets waiting for a busy (locked) database by a fixed timeout.
+    /*! It calls \c sqlite3_busy_timeout(), which replaces any retry policy
+     * set by retry().
+     * \param[in] timeout the maximum time to wait for a lock; 0 disables
+     * waiting */
+    void busy_timeout(std::chrono::milliseconds timeout);
+    //! Sets waiting for a busy (locked) database by a retry policy.
+    /*! It installs a busy handler, which replaces any timeout set by
+     * busy_timeout(). The policy is also used by retry_transaction().
+     * \param[in] policy the retry policy */
+    void retry(const retry_policy& policy);
+    //! Gets the retry policy.
+    /*! \return the policy set by retry(), or the default policy */
+    [[nodiscard]] const retry_policy& retry() const noexcept {
+        return _retry;
+    }
+    //! The default capacity of the cache of prepared queries
+    static constexpr size_t default_cache_capacity = 32;
+    //! Gets a prepared query from the cache of prepared queries.
+    /*! If the cache contains a query with SQL text \a sql, it is removed from
+     * the cache and returned. Otherwise, a new query is prepared. When the
+     * returned lease is destroyed, the query is reset by query::start() and
+     * returned to the cache as the most recently used one. If the cache is
+     * full, the least recently used query is destroyed.
+     * \param[in] sql the query text in SQL
+     * \return the leased query */
+    query_lease cached(std::string sql);
+    //! Sets the capacity of the cache of prepared queries.
+    /*! The least recently used queries are destroyed if the cache contains
+     * more queries than the new capacity.
+     * \param[in] capacity the maximum number of queries in the cache; 0
+     * disables caching */
+    void cache_capacity(size_t capacity);
 private:
     class impl;
+    class cache;
     std::string _file; //!< Database file name
     std::unique_ptr<impl> _impl; //!< Internal implementation object (PIMPL)
+    std::unique_ptr<cache> _cache; //!< The cache of prepared queries
+    retry_policy _retry{}; //!< The retry policy
     query _transaction_begin_deferred; //!< Used by \ref transaction
     query _transaction_begin_immediate; //!< Used by \ref transaction
     query _transaction_begin_exclusive; //!< Used by \ref transaction
@@ -196,13 +510,76 @@ private:
     query _transaction_rollback; //!< Used by \ref transaction
     friend class error;
     friend class query;
+    friend class query_lease;
+    friend class type_error;
     friend class transaction;
 };
 
+//! A pool of connections to a SQLite database
+/*! The pool contains a single writer connection and a reader connection for
+ * each thread that requested one. The database is switched to the WAL journal
+ * mode, so that readers do not block the writer and the writer does not block
+ * readers. Each reader sees the database as committed by the writer when the
+ * reader started its current transaction (or a statement outside of an
+ * explicit transaction). Reader connections are set to \c query_only mode.
+ *
+ * Each connection must be used by a single thread at a time. It is intended
+ * that a single thread uses the writer connection, and each thread uses its
+ * own reader connection, except if connection::options::exclusive is set. All
+ * connections are closed by the destructor of the pool, therefore, threads
+ * using the pool must not access their connections after the pool is
+ * destroyed.
+ * \threadsafe{safe, safe} */
+class pool {
+public:
+    //! Creates the pool.
+    /*! It opens the writer connection and switches the database to the WAL
+     * mode. If options do not specify waiting for a busy database, the
+     * default retry_policy is used.
+     * \param[in] file a database file name; the database must exist
+     * \param[in] opts options of all connections */
+    explicit pool(std::string file, connection::options opts = {});
+    //! No copy
+    pool(const pool&) = delete;
+    //! No move
+    pool(pool&&) = delete;
+    //! Closes all connections.
+    ~pool();
+    //! No copy
+    pool& operator=(const pool&) = delete;
+    //! No move
+    pool& operator=(pool&&) = delete;
+    //! Gets the writer connection.
+    /*! \return the writer connection */
+    connection& writer() noexcept {
+        return *_writer;
+    }
+    //! Gets the reader connection of the calling thread.
+    /*! The connection is opened by the first call in a thread. If the
+     * connections use exclusive locking, other connections cannot access the
+     * database, hence the writer connection is returned.
+     * \return the reader connection */
+    connection& reader();
+    //! Closes the reader connection of the calling thread.
+    /*! It does nothing if the thread does not have a reader connection. */
+    void release_reader();
+private:
+    std::string _file; //!< The database file name
+    connection::options _options; //!< Options of connections
+    std::unique_ptr<connection> _writer; //!< The writer connection
+    std::mutex _readers_mtx; //!< Protects \ref _readers
+    //! Reader connections, indexed by threads
+    std::map<std::thread::id, std::unique_ptr<connection>> _readers{};
+};
+
 //! A database transaction
-/*! \todo Review/fix transaction handling in the case of retried queries after
- * detecting a locked database. Generally, a transaction should be rolled back
- * after a statement in the transaction fails. */
+/*! If a statement in the transaction fails, the transaction should be rolled
+ * back, which is done by the destructor if the exception is propagated out of
+ * the scope of the transaction object. If a statement fails because the
+ * database is busy, retrying just the statement may not help, because another
+ * connection can wait for a lock held by this transaction. The whole
+ * transaction should be rolled back and executed again, which is implemented
+ * by retry_transaction(). */
 class transaction {
 public:
     //! The transaction mode
@@ -221,7 +598,8 @@ public:
     ~transaction();
     //! Commits the transaction.
     /*! It executes <tt>COMMIT TRANSACTION</tt>. It does nothing if commit() or
-     * rollback() has been already called. */
+     * rollback() has been already called. If the commit fails, the
+     * transaction remains active and it is rolled back by the destructor. */
     void commit();
     //! Rolls back the transaction.
     /*! It executes <tt>ROLLBACK TRANSACTION</tt>. It does nothing if commit()
@@ -253,6 +631,150 @@ public:
      * \param[in] db the database connection where the error occurred
      * \param[in] impl the internal SQLite connection object */
     error(const std::string& fun, connection& db, connection::impl& impl);
+protected:
+    //! Stores an error message.
+    /*! \param[in] msg the error message */
+    explicit error(const std::string& msg): runtime_error(msg) {}
 };
 
+//! An exception thrown if an SQLite operation fails because the database is busy (locked)
+/*! The operation can succeed if the enclosing transaction is rolled back and
+ * retried. */
+class busy_error: public error {
+public:
+    using error::error;
+};
+
+//! Executes a function in a transaction, retrying if the database is busy.
+/*! Function \a f is called in a new transaction, which is committed after \a
+ * f returns, unless \a f has already committed or rolled back the transaction.
+ * If \a f or the commit throws busy_error, the transaction is rolled back,
+ * and after a delay defined by the retry policy of \a db (see
+ * connection::retry()), a new transaction is started and \a f is called again.
+ * Therefore, \a f must be prepared to be called repeatedly, and any state
+ * outside the database changed by \a f must be reset by \a f when it is
+ * called again.
+ * \tparam F a function type
+ * \param[in] db a database connection
+ * \param[in] f a function called with the transaction as the argument
+ * \param[in] m the transaction mode
+ * \return the value returned by the last call of \a f
+ * \throw busy_error if the retries specified by the retry policy are
+ * exhausted */
+template <std::invocable<transaction&> F>
+std::invoke_result_t<F, transaction&> retry_transaction(connection& db, F&& f,
+                                                        transaction::mode m = transaction::mode::immediate)
+{
+    for (uint32_t retry = 0; ; ++retry) {
+        try {
+            transaction tr{db, m};
+            if constexpr (std::is_void_v<std::invoke_result_t<F, transaction&>>) {
+                std::invoke(f, tr);
+                tr.commit();
+                return;
+            } else {
+                auto result = std::invoke(f, tr);
+                tr.commit();
+                return result;
+            }
+        } catch (const busy_error&) {
+            if (retry >= db.retry().max_retries)
+                throw;
+        }
+        db.retry().wait(retry);
+    }
+}
+
+//! An exception thrown if a column value has a type different from the expected type
+class type_error: public error {
+public:
+    //! Stores information about the error.
+    /*! \param[in] db the database connection where the error occurred
+     * \param[in] sql the query returning the value
+     * \param[in] i the column index */
+    explicit type_error(connection& db, const std::string& sql, int i);
+};
+
+template <column_result_type... T> class query::row_range {
+public:
+    //! An input iterator over rows
+    class iterator {
+    public:
+        //! The type of a row
+        using value_type = std::tuple<T...>;
+        //! The difference type, required by \c std::input_iterator
+        using difference_type = std::ptrdiff_t;
+        //! Gets the current row.
+        /*! \return the values of columns */
+        value_type operator*() const {
+            return q->template row<T...>();
+        }
+        //! Moves to the next row.
+        /*! \return \c *this */
+        iterator& operator++() {
+            if (q->next_row() != status::row)
+                q = nullptr;
+            return *this;
+        }
+        //! Moves to the next row.
+        void operator++(int) {
+            ++*this;
+        }
+        //! Checks if the end of the query result has been reached.
+        /*! \return whether there are no more rows */
+        bool operator==(std::default_sentinel_t) const noexcept {
+            return !q;
+        }
+    private:
+        //! Creates the iterator.
+        /*! \param[in] q the query, \c nullptr for the end of the result */
+        explicit iterator(query* q) noexcept: q(q) {}
+        query* q; //!< The query, \c nullptr after the last row
+        friend class row_range;
+    };
+    //! Creates the range.
+    /*! \param[in] q a started query */
+    explicit row_range(query& q) noexcept: q(q) {}
+    //! Gets the first row.
+    /*! \return the iterator to the first row */
+    iterator begin() {
+        return ++iterator{&q};
+    }
+    //! Gets the end of the range.
+    /*! \return the end sentinel */
+    static std::default_sentinel_t end() noexcept {
+        return {};
+    }
+private:
+    query& q; //!< The query
+};
+
+template <column_result_type T> T query::get(int i)
+{
+    if constexpr (sqlite::impl::is_optional<T>) {
+        if (get_column_type(i) == column_type::ct_null)
+            return std::nullopt;
+        return get<typename T::value_type>(i);
+    } else {
+        auto check = [this, i](column_type t) {
+            if (get_column_type(i) != t)
+                throw type_error(_db, _sql, i);
+        };
+        if constexpr (std::is_same_v<T, int64_t>) {
+            check(column_type::ct_int64);
+            return get_int64(i);
+        } else if constexpr (std::is_same_v<T, double>) {
+            check(column_type::ct_double);
+            return get_double(i);
+        } else if constexpr (std::is_same_v<T, std::string_view> || std::is_same_v<T, std::string>) {
+            check(column_type::ct_string);
+            return T{get_text(i)};
+        } else {
+            check(column_type::ct_blob);
+            auto b = get_blob(i);
+            return T(b.begin(), b.end());
+        }
+    }
+}
+
 } // namespace sqlite
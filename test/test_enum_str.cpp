@@ -39,6 +39,14 @@ enum class test_enum: int {
     val2,
 };
 
+// Values are not dense, the conversion table is not sorted
+enum class sparse_enum: int {
+    neg = -5,
+    zero = 0,
+    big = 1000,
+    mid = 7,
+};
+
 } // namespace
 
 SOFICPP_IMPL_ENUM_STR_INIT(test_enum) {
@@ -47,6 +55,13 @@ SOFICPP_IMPL_ENUM_STR_INIT(test_enum) {
     SOFICPP_IMPL_ENUM_STR_VAL(test_enum, val2),
 };
 
+SOFICPP_IMPL_ENUM_STR_INIT(sparse_enum) {
+    SOFICPP_IMPL_ENUM_STR_VAL(sparse_enum, zero),
+    SOFICPP_IMPL_ENUM_STR_VAL(sparse_enum, big),
+    SOFICPP_IMPL_ENUM_STR_VAL(sparse_enum, neg),
+    SOFICPP_IMPL_ENUM_STR_VAL(sparse_enum, mid),
+};
+
 namespace {
 
 std::ostream& operator<<(std::ostream& os, test_enum e)
@@ -55,6 +70,12 @@ std::ostream& operator<<(std::ostream& os, test_enum e)
     return os;
 }
 
+std::ostream& operator<<(std::ostream& os, sparse_enum e)
+{
+    os << soficpp::enum2str(e);
+    return os;
+}
+
 } // namespace
 //! \endcond
 
@@ -82,3 +103,43 @@ BOOST_AUTO_TEST_CASE(str2enum)
     BOOST_CHECK_THROW(soficpp::str2enum<test_enum>("false"), std::invalid_argument);
 }
 //! \endcond
+
+/*! \file
+ * \test \c enum2sv -- Test converting enumeration values to string views,
+ * including evaluation at compile time */
+//! \cond
+BOOST_AUTO_TEST_CASE(enum2sv)
+{
+    static_assert(soficpp::enum2sv(test_enum::val1) == "val1");
+    static_assert(soficpp::enum2sv(true) == "true");
+    static_assert(soficpp::enum2sv(sparse_enum::mid) == "mid");
+    BOOST_TEST(soficpp::enum2sv(test_enum::val0) == "val0");
+    BOOST_TEST(soficpp::enum2sv(test_enum::val2) == "val2");
+    BOOST_TEST(soficpp::enum2sv(static_cast<test_enum>(-1)).empty());
+    BOOST_TEST(soficpp::enum2sv(static_cast<test_enum>(3)).empty());
+    BOOST_TEST(soficpp::enum2sv(false) == "false");
+}
+//! \endcond
+
+/*! \file
+ * \test \c sparse_enum2str -- Test conversions of an enumeration with values
+ * not forming a contiguous range */
+//! \cond
+BOOST_AUTO_TEST_CASE(sparse_enum2str)
+{
+    static_assert(soficpp::str2enum<sparse_enum>("big") == sparse_enum::big);
+    for (auto [e, s]: std::initializer_list<std::pair<sparse_enum, std::string_view>>{
+        {sparse_enum::neg, "neg"}, {sparse_enum::zero, "zero"},
+        {sparse_enum::mid, "mid"}, {sparse_enum::big, "big"}})
+    {
+        BOOST_TEST(soficpp::enum2sv(e) == s);
+        BOOST_TEST(soficpp::enum2str(e) == s);
+        BOOST_TEST(soficpp::str2enum<sparse_enum>(s) == e);
+    }
+    BOOST_TEST(soficpp::enum2sv(static_cast<sparse_enum>(1)).empty());
+    BOOST_TEST(soficpp::enum2str(static_cast<sparse_enum>(8)) == "8");
+    BOOST_TEST(soficpp::enum2str(static_cast<sparse_enum>(-6)) == "-6");
+    BOOST_CHECK_THROW(soficpp::str2enum<sparse_enum>("val0"), std::invalid_argument);
+    BOOST_CHECK_THROW(soficpp::str2enum<sparse_enum>(""), std::invalid_argument);
+}
+//! \endcond
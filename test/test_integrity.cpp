@@ -657,3 +657,126 @@ BOOST_AUTO_TEST_CASE(integrity_shared)
     BOOST_TEST(&(i7 * i7).value() == &i7.value());
 }
 //! \endcond
+
+/*! \file
+ * \test \c leq_geq -- Functions soficpp::leq() and soficpp::geq() return the
+ * same results as operators \c <= and \c >= */
+//! \cond
+namespace {
+
+template <class T> void check_leq_geq(const std::vector<T>& values)
+{
+    for (auto&& i1: values)
+        for (auto&& i2: values) {
+            BOOST_TEST_INFO_SCOPE(i1 << " ? " << i2);
+            BOOST_TEST(soficpp::leq(i1, i2) == (i1 <= i2));
+            BOOST_TEST(soficpp::geq(i1, i2) == (i1 >= i2));
+        }
+}
+
+template <size_t S> void check_leq_geq_signature(const std::vector<soficpp::integrity_set<std::string>>& values)
+{
+    using sig_set_t = soficpp::integrity_set<std::string, S>;
+    std::vector<sig_set_t> sig_values{};
+    for (auto&& v: values)
+        if (auto p = std::get_if<soficpp::integrity_set<std::string>::set_t>(&v.value()))
+            sig_values.emplace_back(*p);
+        else
+            sig_values.emplace_back(typename sig_set_t::universe{});
+    check_leq_geq(sig_values);
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(leq_geq)
+{
+    static_assert(!soficpp::impl::integrity_leq<int>);
+    check_leq_geq<int>({0, 1, 2});
+    check_leq_geq<soficpp::integrity_single>({{}});
+    using linear_t = soficpp::integrity_linear<int, 0, 10>;
+    check_leq_geq<linear_t>({linear_t{0}, linear_t{5}, linear_t{10}});
+    using bitset_t = soficpp::integrity_bitset<4>;
+    check_leq_geq<bitset_t>({
+        bitset_t{}, bitset_t{bitset_t::value_type{"0001"}}, bitset_t{bitset_t::value_type{"0011"}},
+        bitset_t{bitset_t::value_type{"0110"}}, bitset_t::max(),
+    });
+    using set_t = soficpp::integrity_set<std::string>;
+    std::vector<set_t> sets{
+        set_t{}, set_t{set_t::set_t{"v1"}}, set_t{set_t::set_t{"v2"}}, set_t{set_t::set_t{"v1", "v2"}},
+        set_t{set_t::set_t{"v1", "v3"}}, set_t{set_t::set_t{"v0", "v1", "v2"}},
+        set_t{set_t::set_t{"v1", "v2", "v3", "v4"}}, set_t{set_t::universe{}},
+    };
+    check_leq_geq(sets);
+    check_leq_geq_signature<64>(sets);
+    check_leq_geq_signature<128>(sets);
+    using shared_t = soficpp::integrity_shared<set_t>;
+    std::vector<shared_t> shared{};
+    for (auto&& s: sets)
+        shared.emplace_back(set_t{s});
+    shared.push_back(shared_t::min());
+    shared.push_back(shared_t::max());
+    check_leq_geq(shared);
+}
+//! \endcond
+
+/*! \file
+ * \test \c integrity_set_signature -- Signatures of soficpp::integrity_set
+ * are maintained by constructors and lattice operations */
+//! \cond
+BOOST_AUTO_TEST_CASE(integrity_set_signature)
+{
+    using integrity_t = soficpp::integrity_set<std::string, 64>;
+    static_assert(sizeof(soficpp::integrity_set<std::string>) == sizeof(integrity_t::value_type));
+    BOOST_TEST(soficpp::integrity_set<std::string>{}.signature().none());
+    integrity_t i0{};
+    integrity_t i1{integrity_t::set_t{"v1", "v2"}};
+    integrity_t i2{integrity_t::set_t{"v2", "v3"}};
+    integrity_t i3{integrity_t::set_t{"v4"}};
+    integrity_t u{integrity_t::universe{}};
+    BOOST_TEST(i0.signature().none());
+    BOOST_TEST(u.signature().all());
+    BOOST_TEST(i1.signature().any());
+    BOOST_TEST(i1.signature().count() <= 2);
+    for (auto&& a: {i0, i1, i2, i3, u})
+        for (auto&& b: {i0, i1, i2, i3, u}) {
+            BOOST_TEST_INFO_SCOPE(a << " ? " << b);
+            integrity_t join{(a + b).value()};
+            BOOST_TEST((a + b).signature() == join.signature());
+            BOOST_TEST((a + b) == join);
+            integrity_t meet{(a * b).value()};
+            BOOST_TEST((a * b).signature() == meet.signature());
+            BOOST_TEST((a * b) == meet);
+        }
+}
+//! \endcond
+
+/*! \file
+ * \test \c integrity_set_heterogeneous -- Construction of soficpp::integrity_set
+ * and membership tests using values of a type different from the element type */
+//! \cond
+BOOST_AUTO_TEST_CASE(integrity_set_heterogeneous)
+{
+    using namespace std::string_view_literals;
+    using integrity_t = soficpp::integrity_set<std::string, 64>;
+    integrity_t expected{integrity_t::set_t{"v1", "v2", "v3"}};
+    // construction from unsorted values with duplicates
+    integrity_t i1{std::vector{"v3"sv, "v1"sv, "v2"sv, "v1"sv}};
+    BOOST_TEST(i1 == expected);
+    BOOST_TEST(i1.signature() == expected.signature());
+    // construction from sorted values
+    integrity_t i2{integrity_t::sorted_unique, std::vector{"v1"sv, "v2"sv, "v3"sv}};
+    BOOST_TEST(i2 == expected);
+    BOOST_TEST(i2.signature() == expected.signature());
+    // precondition violated, still correct
+    integrity_t i3{integrity_t::sorted_unique, std::vector{"v2"sv, "v3"sv, "v1"sv, "v3"sv}};
+    BOOST_TEST(i3 == expected);
+    integrity_t i4{integrity_t::sorted_unique, std::vector<std::string_view>{}};
+    BOOST_TEST(i4 == integrity_t::min());
+    // membership
+    BOOST_TEST(i1.contains("v2"sv));
+    BOOST_TEST(!i1.contains("v4"sv));
+    BOOST_TEST(i1.contains(std::string{"v3"}));
+    BOOST_TEST(!i4.contains("v1"sv));
+    BOOST_TEST(integrity_t::max().contains("v4"sv));
+}
+//! \endcond
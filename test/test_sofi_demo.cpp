@@ -24,7 +24,10 @@
 #include "sqlite_cpp.hpp"
 
 #include <cstdlib>
+#include <chrono>
 #include <filesystem>
+#include <fstream>
+#include <thread>
 
 #if __has_include(<sys/types.h>) && __has_include(<sys/wait.h>)
 #include <sys/types.h>
@@ -84,10 +87,21 @@ void sofi_demo_init()
     sofi_demo_do("init");
 }
 
-void sofi_demo_run()
+void sofi_demo_run(std::string_view cmd = "run")
 {
     BOOST_TEST_MESSAGE(""); // adjusts color and reports context
-    sofi_demo_do("run");
+    sofi_demo_do(cmd);
+}
+
+int sofi_demo_status(std::string_view cmd)
+{
+    auto exe = sofi_demo_exe();
+    exe += ' ';
+    exe.append(cmd);
+    exe += ' ';
+    exe += db_file;
+    exe += " > /dev/null 2>&1";
+    return system(exe.c_str()); // NOLINT(concurrency-mt-unsafe)
 }
 
 struct sql_grp {
@@ -98,6 +112,7 @@ struct sql_grp {
 struct sofi_test {
     std::vector<sql_grp> sql_prepare;
     std::vector<sql_grp> sql_check;
+    std::vector<std::string> commands{"run"};
     void run() {
         bool log_sql = custom_arg('d');
         sofi_demo_init();
@@ -119,7 +134,8 @@ struct sofi_test {
                 BOOST_REQUIRE_NO_THROW(op());
             }
         }
-        sofi_demo_run();
+        for (auto&& cmd: commands)
+            sofi_demo_run(cmd);
         if (log_sql)
             for (auto&& grp: sql_check) {
                 BOOST_TEST_MESSAGE("CHECK GROUP " << grp.name);
@@ -185,6 +201,37 @@ std::string var(const std::string& name, const std::string& value_sql)
     return R"(insert or replace into var values (')" + name + R"(', ()" + value_sql + R"()))";
 }
 
+// An INSERT statement of entity NAME with DATA given by an SQL expression, and
+// with integrity INTEGRITY and ACL ACL given by names of variables. The minimum
+// integrity allows anything, the integrity functions are identity, min, max.
+std::string entity(const std::string& name, const std::string& data = "''",
+                   const std::string& integrity = "integrity_universe", const std::string& acl = "acl_allow")
+{
+    return R"(insert into entity values (')"s + name + R"(', )" +
+        var(integrity) + R"(, )"s + var("min_int_any") + R"(, )" +
+        var(acl) + R"(, )" + var("fun_identity") + R"(, )" +
+        var("fun_min") + R"(, )" + var("fun_max") + R"(, )" + data + R"())";
+}
+
+// An SQL expression: concatenated values I || ',' for I = 1, ..., N, where I % M == K
+std::string appended(int n, int m, int k)
+{
+    return R"((with recursive n(i) as (select 1 union all select i + 1 from n where i < )"s + std::to_string(n) +
+        R"() select group_concat(i || ',', '') from (select i from n where i % )" + std::to_string(m) +
+        R"( == )" + std::to_string(k) + R"( order by i)))";
+}
+
+// Checks that each query returns a row with the single value 1
+void check(sqlite::connection& db, const std::vector<std::string>& sql)
+{
+    for (auto&& q_sql: sql) {
+        BOOST_TEST_INFO_SCOPE("sql_check: " << q_sql);
+        sqlite::query q{db, q_sql};
+        BOOST_TEST_REQUIRE(q.start().next_row() == sqlite::query::status::row);
+        BOOST_TEST(q.get<int64_t>(0) == 1);
+    }
+}
+
 sql_grp var()
 {
     sql_grp grp{.name = "var", .sql = {
@@ -342,9 +389,68 @@ BOOST_AUTO_TEST_CASE(op_clone)
                 R"(select data == '[subj_data]' from entity where name == 'subject')",
                 R"(select data == '[obj_data]' from entity where name == 'object')",
                 R"(select data == '[obj_data]' from entity where name == 'copy_of_object')",
+                // The copy references the same parts as the object
+                R"(select count() == 1 from (
+                    select distinct integrity, min_integrity, acl, test_fun, prov_fun, recv_fun, policy
+                    from entity join entity_policy using (name) where name in ('object', 'copy_of_object')))",
+            }},
+        },
+    }.run();
+}
+//! \endcond
+
+/*! \file
+ * \test \c operation_find -- Each operation name maps to the operation of the
+ * same name, unknown names and near misses (the same length and the first
+ * character) are rejected */
+//! \cond
+BOOST_AUTO_TEST_CASE(operation_find)
+{
+    sofi_test{
+        .sql_prepare = {
+            query::var(),
+            { "entities", {
+                query::entity("subject"),
+                R"(insert into entity select 'o_' || name, )"s +
+                    query::var("integrity_universe") + R"(, )"s + query::var("min_int_any") + R"(, )" +
+                    query::var("acl_allow") + R"(, )" + query::var("fun_identity") + R"(, )" +
+                    query::var("fun_min") + R"(, )" + query::var("fun_max") + R"(, '' from operation)",
+            }},
+            { "requests", {
+                R"(insert into request_ins select 'subject', 'o_' || name, name,
+                    case name
+                        when 'set_integrity' then '["i1"]' when 'set_min_integrity' then '[[]]'
+                        when 'clone' then 'c_' || name else 'x'
+                    end, name
+                    from operation order by name)",
+            }},
+        },
+        .sql_check = {
+            { "result", {
+                R"(select count() == 12 from operation)",
+                R"(select count() == (select count() from operation) from result where op == comment)",
+                R"(select count() == 0 from request)",
             }},
         },
     }.run();
+    sqlite::connection db{std::string{db_file}, false};
+    std::vector<std::string> names{"unknown", "NO_OP"};
+    {
+        sqlite::query q{db, R"(select name from operation)"};
+        for (q.start(); q.next_row() == sqlite::query::status::row;) {
+            auto& n = names.emplace_back(q.get<std::string>(0));
+            ++n.back();
+        }
+    }
+    for (auto&& name: names) {
+        BOOST_TEST_INFO_SCOPE("name: " << name);
+        sqlite::query(db, R"(insert into operation values (?1, false, false))").start().bind(1, name).next_row();
+        sqlite::query(db, R"(insert into request_ins values ('subject', 'subject', ?1, null, ''))").start().
+            bind(1, name).next_row();
+        BOOST_TEST(sofi_demo_status("run") != 0);
+        sqlite::query(db, R"(delete from request)").start().next_row();
+        sqlite::query(db, R"(delete from operation where name == ?1)").start().bind(1, name).next_row();
+    }
 }
 //! \endcond
 
@@ -473,6 +579,992 @@ BOOST_AUTO_TEST_CASE(op_set_min_integrity)
     }.run();
 }
 
+/*! \file
+ * \test \c integrity_json -- Arguments of operations \c set_integrity and \c
+ * set_min_integrity are parsed with whitespace, escape sequences, and
+ * duplicate elements; invalid arguments cause an error */
+//! \cond
+BOOST_AUTO_TEST_CASE(integrity_json)
+{
+    sofi_test{
+        .sql_prepare = {
+            query::var(),
+            { "entities", {
+                query::entity("subject", "'[subj_data]'"),
+                query::entity("object", "'[obj_data]'"),
+            }},
+            { "requests", {
+                R"(insert into request_ins values ('subject', 'object', 'set_integrity',
+                    ' [ "x", "a\"b" , "\u00e9" ,"x", "\ud83d\ude00" ] ', 'valid'))",
+                R"(insert into request_ins values ('subject', 'subject', 'set_min_integrity',
+                    '[ "universe", [], ["m\n"] ]', 'valid'))",
+                R"(insert into request_ins values ('subject', 'object', 'set_integrity', '["a",]', 'invalid'))",
+                R"(insert into request_ins values ('subject', 'object', 'set_integrity', '"all"', 'invalid'))",
+                R"(insert into request_ins values ('subject', 'object', 'set_min_integrity', '[["a"]', 'invalid'))",
+            }},
+        },
+        .sql_check = {
+            { "result", {
+                R"(select count() == 2 from result where comment == 'valid' and allowed and not error)",
+                R"(select count() == 3 from result where comment == 'invalid' and error)",
+            }},
+            { "entity", {
+                R"(select elems == '["a\"b","x","é","😀"]'
+                    from entity join integrity_json on entity.integrity == integrity_json.id where name=='object')",
+                R"(with
+                        mi(i) as (
+                            select min_integrity_json.integrity
+                            from entity join min_integrity_json on entity.min_integrity == min_integrity_json.id
+                            where name=='subject'
+                        ),
+                        exp(i) as (values ('"universe"'), ('[]'), ('["m\n"]'))
+                    select (select count() from mi) == (select count() from exp) and
+                        (select count() from mi join exp using (i)) == (select count() from exp))",
+            }},
+        },
+    }.run();
+}
+//! \endcond
+
+/*! \file
+ * \test \c export_dedup -- Exporting equal values reuses their IDs */
+//! \cond
+BOOST_AUTO_TEST_CASE(export_dedup)
+{
+    sofi_test{
+        .sql_prepare = {
+            query::var(),
+            { "entities", {
+                query::entity("subject", "'[subj_data]'"),
+                query::entity("object", "'[obj_data]'"),
+            }},
+            { "requests", {
+                R"(insert into request_ins values ('subject', 'object', 'no_op', '', ''))",
+                R"(insert into request_ins values ('subject', 'object', 'read', '', ''))",
+                R"(insert into request_ins values ('object', 'subject', 'write', '', ''))",
+            }},
+        },
+        .sql_check = {
+            { "op_result", {
+                R"(select count() == 3 from result where allowed and not error)",
+                R"(select count(distinct integrity) == 1 from entity)",
+                R"(select count(distinct min_integrity) == 1 from entity)",
+                R"(select count(distinct acl) == 1 from entity)",
+                R"(select count(distinct test_fun) == 1 from entity)",
+            }},
+            { "hash", {
+                R"(select count() == 2 from integrity_hash)",
+                R"(select count() == 1 from acl_hash)",
+                R"(select count() == 3 from int_fun_hash)",
+                R"(select count() == 1 from integrity_hash as h join integrity_json as i using (id)
+                    where h.content == i.elems and i.elems == '"universe"')",
+            }},
+        },
+    }.run();
+}
+//! \endcond
+
+/*! \file
+ * \test \c request_pages -- Requests spanning several pages are executed in order */
+//! \cond
+BOOST_AUTO_TEST_CASE(request_pages)
+{
+    sofi_test{
+        .sql_prepare = {
+            query::var(),
+            { "entities", {
+                query::entity("subject"),
+            }},
+            { "requests", {
+                R"(insert into request_ins
+                    with recursive n(i) as (select 1 union all select i + 1 from n where i < 2500)
+                    select 'subject', 'subject', 'append_arg', 'x', i from n)",
+            }},
+        },
+        .sql_check = {
+            { "result", {
+                R"(select count() == 2500 from result where allowed and not error)",
+                R"(select count() == 0 from request)",
+                R"(select count() == 0 from result as r1 join result as r2
+                    on r1.id < r2.id and cast(r1.comment as int) > cast(r2.comment as int))",
+            }},
+            { "entity", {
+                R"(select length(data) == 2500 from entity where name == 'subject')",
+            }},
+        },
+    }.run();
+}
+//! \endcond
+
+#ifdef __unix
+/*! \file
+ * \test \c serve -- Command `sofi_demo serve` executes requests inserted while
+ * it is running and exits after \c SIGTERM */
+//! \cond
+BOOST_AUTO_TEST_CASE(serve)
+{
+    using namespace std::chrono_literals;
+    constexpr std::string_view pid_file = "test_sofi_demo.pid";
+    sofi_demo_init();
+    std::filesystem::remove(pid_file);
+    sqlite::connection db{std::string{db_file}, false};
+    db.busy_timeout(10s);
+    auto exec = [&db](const std::string& sql) {
+        BOOST_TEST_INFO_SCOPE("sql: " << sql);
+        sqlite::query q{db, sql};
+        BOOST_TEST_REQUIRE(q.start().next_row() == sqlite::query::status::done);
+    };
+    auto wait_results = [&db](int64_t n) {
+        sqlite::query q{db, R"(select count() from result where allowed and not error)"};
+        for (int i = 0; i < 1000; ++i, std::this_thread::sleep_for(10ms)) {
+            q.start().next_row();
+            if (q.get<int64_t>(0) >= n)
+                break;
+        }
+        q.start().next_row();
+        return q.get<int64_t>(0);
+    };
+    for (auto&& sql: query::var().sql)
+        exec(sql);
+    exec(query::entity("subject"));
+    exec(R"(insert into request_ins values ('subject', 'subject', 'append_arg', 'a', ''))");
+    int status = -1;
+    std::thread server{[&status, pid_file]() {
+        status = system(("echo $$ > "s + std::string{pid_file} + "; exec " + sofi_demo_exe() + // NOLINT
+                         " serve " + std::string{db_file} + " > /dev/null").c_str());
+    }};
+    BOOST_TEST(wait_results(1) == 1);
+    exec(R"(insert into request_ins values ('subject', 'subject', 'append_arg', 'b', ''))");
+    std::this_thread::sleep_for(100ms);
+    exec(R"(insert into request_ins values ('subject', 'subject', 'append_arg', 'c', ''))");
+    BOOST_TEST(wait_results(3) == 3);
+    BOOST_TEST(system(("kill -TERM $(cat "s + std::string{pid_file} + ")").c_str()) == 0); // NOLINT
+    server.join();
+    BOOST_TEST(status == 0);
+    sqlite::query q{db, R"(select data from entity where name == 'subject')"};
+    q.start().next_row();
+    BOOST_TEST(q.get<std::string>(0) == "abc");
+    std::filesystem::remove(pid_file);
+}
+//! \endcond
+
+/*! \file
+ * \test \c serve_stop -- Program \c sofi_demo in the \c serve mode exits after
+ * \c SIGTERM without processing the remaining backlog of requests */
+//! \cond
+BOOST_AUTO_TEST_CASE(serve_stop)
+{
+    using namespace std::chrono_literals;
+    constexpr std::string_view pid_file = "test_sofi_demo.pid";
+    constexpr int64_t total = 20000;
+    sofi_demo_init();
+    std::filesystem::remove(pid_file);
+    sqlite::connection db{std::string{db_file}, false};
+    db.busy_timeout(10s);
+    auto exec = [&db](const std::string& sql) {
+        BOOST_TEST_INFO_SCOPE("sql: " << sql);
+        sqlite::query q{db, sql};
+        BOOST_TEST_REQUIRE(q.start().next_row() == sqlite::query::status::done);
+    };
+    auto value = [&db](const std::string& sql) {
+        sqlite::query q{db, sql};
+        BOOST_TEST_REQUIRE(q.start().next_row() == sqlite::query::status::row);
+        return q.get<int64_t>(0);
+    };
+    for (auto&& sql: query::var().sql)
+        exec(sql);
+    exec(query::entity("subject"));
+    exec(R"(insert into request_ins
+        with recursive n(i) as (select 1 union all select i + 1 from n where i < )"s + std::to_string(total) + R"()
+        select 'subject', 'subject', 'append_arg', 'x', i from n)");
+    int status = -1;
+    std::thread server{[&status, pid_file]() {
+        status = system(("echo $$ > "s + std::string{pid_file} + "; exec " + sofi_demo_exe() + // NOLINT
+                         " serve " + std::string{db_file} + " > /dev/null").c_str());
+    }};
+    for (int i = 0; i < 1000 && value(R"(select count() from result)") == 0; ++i)
+        std::this_thread::sleep_for(10ms);
+    BOOST_TEST(system(("kill -TERM $(cat "s + std::string{pid_file} + ")").c_str()) == 0); // NOLINT
+    server.join();
+    BOOST_TEST(status == 0);
+    auto done = value(R"(select count() from result where allowed and not error)");
+    BOOST_TEST(done > 0);
+    BOOST_TEST(done < total);
+    BOOST_TEST(value(R"(select count() from request)") == total - done);
+    BOOST_TEST(value(R"(select length(data) from entity where name == 'subject')") == done);
+    std::filesystem::remove(pid_file);
+}
+//! \endcond
+#endif
+
+/*! \file
+ * \test \c parallel -- Operations prepared in parallel give the same results as sequential execution */
+//! \cond
+BOOST_AUTO_TEST_CASE(parallel)
+{
+    sofi_test{
+        .sql_prepare = {
+            query::var(),
+            { "entities", { query::entity("s0"), query::entity("s1"), query::entity("s2"), query::entity("s3"), }},
+            { "requests", {
+                R"(insert into request_ins
+                    with recursive n(i) as (select 1 union all select i + 1 from n where i < 400)
+                    select 's' || (i % 4), 's' || (i % 4), 'append_arg', i || ',', i from n)",
+                R"(insert into request_ins values ('s0', 's1', 'swap', '', 'swap'))",
+                R"(insert into request_ins values ('s1', 's1', 'append_arg', 'x', 'append'))",
+                R"(insert into request_ins values ('s2', 's2', 'clone', 's4', 'clone'))",
+                R"(insert into request_ins values ('s4', 's4', 'append_arg', 'y', 'append'))",
+            }},
+        },
+        .sql_check = {
+            { "result", {
+                R"(select count() == 404 from result where allowed and not error)",
+                R"(select count() == 0 from request)",
+            }},
+            { "entity", {
+                R"(select data == )"s + query::appended(400, 4, 1) + R"( from entity where name == 's0')",
+                R"(select data == )"s + query::appended(400, 4, 0) + R"( || 'x' from entity where name == 's1')",
+                R"(select data == )"s + query::appended(400, 4, 2) + R"( from entity where name == 's2')",
+                R"(select data == )"s + query::appended(400, 4, 3) + R"( from entity where name == 's3')",
+                R"(select data == )"s + query::appended(400, 4, 2) + R"( || 'y' from entity where name == 's4')",
+            }},
+        },
+        .commands = {"-j 4 run"},
+    }.run();
+}
+//! \endcond
+
+/*! \file
+ * \test \c shards -- Entities are partitioned into several database files
+ * (shards), which does not change results of operations, including operations
+ * on entities in different shards */
+//! \cond
+BOOST_AUTO_TEST_CASE(shards)
+{
+    // Shards 1 and 2 of the database, left by previous executions of the test
+    auto shard_file = [](int k) { return std::string{db_file} + "." + std::to_string(k); };
+    for (int k = 1; k <= 2; ++k)
+        std::filesystem::remove(shard_file(k));
+    // Entities s0, s1, s2, s3, s5 are stored in shards 0, 1, 1, 2, 2, respectively
+    sofi_test{
+        .sql_prepare = {
+            query::var(),
+            { "entities", { query::entity("s0"), query::entity("s1"), query::entity("s2"), query::entity("s3"), }},
+            { "requests", {
+                R"(insert into request_ins
+                    with recursive n(i) as (select 1 union all select i + 1 from n where i < 300)
+                    select 's' || (i % 4), 's' || (i % 4), 'append_arg', i || ',', i from n)",
+                R"(insert into request_ins values ('s0', 's3', 'swap', '', 'swap'))",
+                R"(insert into request_ins values ('s2', 's2', 'clone', 's5', 'clone'))",
+                R"(insert into request_ins values ('s5', 's5', 'append_arg', 'y', 'append'))",
+                R"(insert into request_ins values ('s0', 's1', 'destroy', '', 'destroy'))",
+                R"(insert into request_ins values ('s0', 's3', 'set_integrity', '["i1"]', 'set_integrity'))",
+            }},
+        },
+        .sql_check = {
+            { "result", {
+                R"(select count() == 305 from result where allowed and not error)",
+                R"(select count() == 0 from request)",
+            }},
+            { "shards", {
+                R"(select n == 3 from shards)",
+                R"(select count() == 0 from shard_pending)",
+                R"(select group_concat(name) == 's0' from entity)",
+            }},
+        },
+        .commands = {"-s 3 reshard", "run", "gc"},
+    }.run();
+    // Move all entities back to shard 0
+    sofi_demo_run("-s 1 reshard");
+    sqlite::connection db{std::string{db_file}, false};
+    query::check(db, {
+        R"(select n == 1 from shards)"s,
+        R"(select group_concat(name) == 's0,s2,s3,s5' from (select name from entity order by name))"s,
+        R"(select data == )"s + query::appended(300, 4, 3) + R"( from entity where name == 's0')",
+        R"(select data == )"s + query::appended(300, 4, 2) + R"( from entity where name == 's2')",
+        R"(select data == )"s + query::appended(300, 4, 0) + R"( from entity where name == 's3')",
+        R"(select data == )"s + query::appended(300, 4, 2) + R"( || 'y' from entity where name == 's5')",
+        R"(select integrity == '["i1"]' from entity_json where name == 's3')"s,
+    });
+    for (int k = 1; k <= 2; ++k) {
+        sqlite::connection sdb{shard_file(k), false};
+        query::check(sdb, {R"(select count() == 0 from entity)"});
+    }
+}
+//! \endcond
+
+/*! \file
+ * \test \c reshard_interrupted -- Commands refuse to use the database while
+ * an interrupted \c reshard has not finished, and \c gc, \c compile, and \c
+ * reshard refuse to run while entities of an interrupted \c run are pending */
+//! \cond
+BOOST_AUTO_TEST_CASE(reshard_interrupted)
+{
+    // Shards 1 and 2 of the database, left by previous executions of the test
+    for (int k = 1; k <= 2; ++k)
+        std::filesystem::remove(std::string{db_file} + "." + std::to_string(k));
+    sofi_test{
+        .sql_prepare = {
+            query::var(),
+            { "entities", { query::entity("s0"), query::entity("s1"), query::entity("s2"), query::entity("s3"), }},
+            { "requests", {
+                R"(insert into request_ins select name, name, 'append_arg', 'x', '' from entity)",
+            }},
+        },
+        .sql_check = {
+            { "shards", {
+                R"(select n == 2 and target is null from shards)",
+            }},
+        },
+        .commands = {"-s 2 reshard", "run"},
+    }.run();
+    sqlite::connection db{std::string{db_file}, false};
+    auto exec = [&db](const std::string& sql) {
+        BOOST_TEST_INFO_SCOPE("sql: " << sql);
+        sqlite::query q{db, sql};
+        BOOST_TEST_REQUIRE(q.start().next_row() == sqlite::query::status::done);
+    };
+    // A reshard to 3 shards interrupted after moving some entities
+    exec(R"(update shards set target = 3)");
+    for (auto&& cmd: {"run", "gc", "compile"}) {
+        BOOST_TEST_INFO_SCOPE("command: " << cmd);
+        BOOST_TEST(sofi_demo_status(cmd) != 0);
+    }
+    query::check(db, {R"(select n == 2 and target == 3 from shards)"});
+    sofi_demo_run("-s 3 reshard");
+    query::check(db, {R"(select n == 3 and target is null from shards)"});
+    // A run interrupted after committing a batch
+    exec(R"(insert into shard_pending values ('s9', null, null))");
+    for (auto&& cmd: {"gc", "compile", "-s 2 reshard"}) {
+        BOOST_TEST_INFO_SCOPE("command: " << cmd);
+        BOOST_TEST(sofi_demo_status(cmd) != 0);
+    }
+    query::check(db, {R"(select n == 3 and target is null from shards)"});
+    sofi_demo_run("run");
+    query::check(db, {R"(select count() == 0 from shard_pending)"});
+    sofi_demo_run("gc");
+    sofi_demo_run("compile");
+    sofi_demo_run("-s 1 reshard");
+    query::check(db, {R"(select count() == 4 from entity where data == 'x')"});
+}
+//! \endcond
+
+/*! \file
+ * \test \c log_storage -- Entities are stored in an append-only log and a
+ * snapshot instead of the database, and then stored back to the database */
+//! \cond
+BOOST_AUTO_TEST_CASE(log_storage)
+{
+    // Files of the log storage, left by previous executions of the test
+    const std::string log_file = std::string{db_file} + ".log";
+    const std::string snap_file = std::string{db_file} + ".snap";
+    std::filesystem::remove(log_file);
+    std::filesystem::remove(snap_file);
+    sofi_test{
+        .sql_prepare = {
+            query::var(),
+            { "entities", { query::entity("s0"), query::entity("s1"), query::entity("s2"), }},
+            { "requests", {
+                R"(insert into request_ins
+                    with recursive n(i) as (select 1 union all select i + 1 from n where i < 200)
+                    select 's' || (i % 3), 's' || (i % 3), 'append_arg', i || ',', i from n)",
+                R"(insert into request_ins values ('s0', 's1', 'swap', '', 'swap'))",
+                R"(insert into request_ins values ('s2', 's2', 'clone', 's3', 'clone'))",
+                R"(insert into request_ins values ('s3', 's3', 'append_arg', 'y', 'append'))",
+                R"(insert into request_ins values ('s0', 's2', 'destroy', '', 'destroy'))",
+                R"(insert into request_ins values ('s0', 's1', 'set_integrity', '["i1"]', 'set_integrity'))",
+            }},
+        },
+        .sql_check = {
+            { "result", {
+                R"(select count() == 205 from result where allowed and not error)",
+                R"(select count() == 0 from request)",
+            }},
+            { "entity", {
+                R"(select group_concat(name) == 's0,s1,s2' from (select name from entity order by name))",
+                R"(select count() == 3 from entity where data == '')",
+            }},
+        },
+        // The second run loads the snapshot and replays the log
+        .commands = {"-b log run", "-b log run"},
+    }.run();
+    BOOST_TEST(std::filesystem::exists(log_file));
+    BOOST_TEST(std::filesystem::exists(snap_file));
+    sofi_demo_run("checkpoint");
+    BOOST_TEST(!std::filesystem::exists(log_file));
+    BOOST_TEST(!std::filesystem::exists(snap_file));
+    sqlite::connection db{std::string{db_file}, false};
+    query::check(db, {
+        R"(select group_concat(name) == 's0,s1,s3' from (select name from entity order by name))"s,
+        R"(select data == )"s + query::appended(200, 3, 1) + R"( from entity where name == 's0')",
+        R"(select data == )"s + query::appended(200, 3, 0) + R"( from entity where name == 's1')",
+        R"(select data == )"s + query::appended(200, 3, 2) + R"( || 'y' from entity where name == 's3')",
+        R"(select integrity == '["i1"]' from entity_json where name == 's1')"s,
+    });
+}
+//! \endcond
+
+/*! \file
+ * \test \c log_storage_mixed -- Commands using entities in the database refuse
+ * to run while entities are stored in a log, so that a checkpoint does not
+ * lose their changes */
+//! \cond
+BOOST_AUTO_TEST_CASE(log_storage_mixed)
+{
+    std::filesystem::remove(std::string{db_file} + ".log");
+    std::filesystem::remove(std::string{db_file} + ".snap");
+    sofi_test{
+        .sql_prepare = {
+            query::var(),
+            { "entities", { query::entity("subject"), }},
+            { "requests", {
+                R"(insert into request_ins values ('subject', 'subject', 'append_arg', 'A', ''))",
+            }},
+        },
+        .sql_check = {
+            { "result", {
+                R"(select count() == 1 from result where allowed and not error)",
+            }},
+        },
+        .commands = {"-b log run"},
+    }.run();
+    sqlite::connection db{std::string{db_file}, false};
+    sqlite::query(db, R"(insert into request_ins values ('subject', 'subject', 'append_arg', 'B', ''))").
+        start().next_row();
+    for (auto&& cmd: {"run", "gc", "-s 2 reshard"}) {
+        BOOST_TEST_INFO_SCOPE("command: " << cmd);
+        BOOST_TEST(sofi_demo_status(cmd) != 0);
+    }
+    query::check(db, {
+        R"(select count() == 1 from request)",
+        R"(select data == '' from entity where name == 'subject')",
+    });
+    sofi_demo_run("checkpoint");
+    query::check(db, {R"(select data == 'A' from entity where name == 'subject')"});
+    sofi_demo_run("run");
+    query::check(db, {
+        R"(select count() == 0 from request)",
+        R"(select data == 'AB' from entity where name == 'subject')",
+    });
+}
+//! \endcond
+
+/*! \file
+ * \test \c large_data -- Large data are shared and appended by operations,
+ * stored in a log, and then in the database */
+//! \cond
+BOOST_AUTO_TEST_CASE(large_data)
+{
+    std::filesystem::remove(std::string{db_file} + ".log");
+    std::filesystem::remove(std::string{db_file} + ".snap");
+    // A string of N characters 'x'
+    auto x = [](int n) {
+        return R"(replace(hex(zeroblob()"s + std::to_string(n / 2) + R"()), '0', 'x'))";
+    };
+    sofi_test{
+        .sql_prepare = {
+            query::var(),
+            { "entities", { query::entity("a", x(5000)), query::entity("b"), }},
+            { "requests", {
+                R"(insert into request_ins
+                    with recursive n(i) as (select 1 union all select i + 1 from n where i < 20)
+                    select 'a', 'b', 'write_append', '', 'write_append' from n)",
+                R"(insert into request_ins values ('a', 'b', 'read', '', 'read'))",
+                R"(insert into request_ins values ('a', 'b', 'read_append', '', 'read_append'))",
+                R"(insert into request_ins values ('b', 'b', 'append_arg', 'y', 'append_arg'))",
+            }},
+        },
+        .sql_check = {
+            { "result", {
+                R"(select count() == 23 from result where allowed and not error)",
+            }},
+            { "entity", {
+                R"(select data == )"s + x(200000) + R"( from entity where name == 'a')",
+                R"(select data == )"s + x(100000) + R"( || 'y' from entity where name == 'b')",
+            }},
+        },
+        .commands = {"-b log run", "checkpoint"},
+    }.run();
+}
+//! \endcond
+
+/*! \file
+ * \test \c policy_image -- Verdicts evaluated using a compiled policy image
+ * are the same as verdicts of executed operations */
+//! \cond
+BOOST_AUTO_TEST_CASE(policy_image)
+{
+    // The output of command check, left by previous executions of the test
+    const std::string check_file = std::string{db_file} + ".check";
+    const std::string image_file = std::string{db_file} + ".policy";
+    auto entity = [](const std::string& name, const std::string& integrity, const std::string& acl) {
+        return query::entity(name, "'[" + name + "]'", integrity, acl);
+    };
+    // The image contains entities from all shards
+    for (auto&& reshard: {"-s 1 reshard", "-s 2 reshard"}) {
+        BOOST_TEST_INFO_SCOPE("command: " << reshard);
+        std::filesystem::remove(check_file);
+        std::filesystem::remove(image_file);
+        std::filesystem::remove(std::string{db_file} + ".1");
+        // Each entity is used by a single operation, therefore, verdicts do not
+        // depend on changes made by earlier operations
+        sofi_test{
+            .sql_prepare = {
+                query::var(),
+                { "entities", {
+                    entity("s1", "integrity_universe", "acl_allow"), entity("o1", "integrity_empty", "acl_allow"),
+                    entity("s2", "integrity_empty", "acl_allow"), entity("o2", "integrity_universe", "acl_allow"),
+                    entity("s3", "integrity_universe", "acl_allow"), entity("o3", "integrity_universe", "acl_deny"),
+                    entity("s4", "integrity_empty", "acl_allow"), entity("o4", "integrity_universe", "acl_allow"),
+                }},
+                { "requests", {
+                    R"(insert into request_ins values ('s1', 'o1', 'write', '', 'write down'))",
+                    R"(insert into request_ins values ('s2', 'o2', 'write', '', 'write up'))",
+                    R"(insert into request_ins values ('s3', 'o3', 'read', '', 'denied by ACL'))",
+                    R"(insert into request_ins values ('s4', 'o4', 'read', '', 'read down'))",
+                }},
+            },
+            .sql_check = {
+                { "result", {
+                    R"(select count() == 4 from result)",
+                    R"(select count() between 1 and 3 from result where allowed)",
+                }},
+            },
+            .commands = {reshard, "compile", "check > "s + check_file, "run"},
+        }.run();
+        BOOST_TEST(std::filesystem::exists(image_file));
+        std::ifstream check{check_file};
+        std::string checked{};
+        int verdicts = 0;
+        for (std::string line{}; std::getline(check, line);)
+            if (line.starts_with("CHECK ")) {
+                checked += line + "\n";
+                ++verdicts;
+            }
+        BOOST_TEST(verdicts == 4);
+        sqlite::connection db{std::string{db_file}, false};
+        query::check(db, {
+            R"(select group_concat('CHECK ' || id || ' allowed=' || allowed || ' access=' || access ||
+                ' min=' || min || char(10), '') == ')" + checked + R"(' from (select * from result order by id))",
+        });
+    }
+}
+//! \endcond
+
+/*! \file
+ * \test \c id_sequence -- IDs are allocated from sequences */
+//! \cond
+BOOST_AUTO_TEST_CASE(id_sequence)
+{
+    sofi_test{
+        .sql_prepare = {
+            query::var(),
+            { "entities", {
+                query::entity("subject", "'[subj_data]'"),
+                query::entity("object", "'[obj_data]'"),
+            }},
+            { "requests", {
+                R"(insert into request_ins values ('subject', 'object', 'set_integrity', '["i1"]', ''))",
+                R"(insert into request values (10, 'subject', 'object', 'set_integrity', '["i2"]', ''))",
+                R"(insert into request_ins values ('subject', 'object', 'set_min_integrity', '[["m"]]', ''))",
+            }},
+        },
+        .sql_check = {
+            { "result", {
+                R"(select count() == 3 from result where allowed and not error)",
+                R"(select group_concat(id) == '0,10,11' from (select id from result order by id))",
+            }},
+            { "sequence", {
+                R"(select next == 12 from sequence where name == 'request')",
+                R"(select count() == 0 from integrity_id
+                    where id >= (select next from sequence where name == 'integrity_id'))",
+                R"(select count() == 0 from acl_id where id >= (select next from sequence where name == 'acl_id'))",
+                R"(select count() == 0 from int_fun_id
+                    where id >= (select next from sequence where name == 'int_fun_id'))",
+                R"(select count() == 3 from integrity_hash where content in ('["i1"]', '["i2"]', '["m"]'))",
+            }},
+        },
+    }.run();
+}
+//! \endcond
+
+/*! \file
+ * \test \c busy_retry -- Program \c sofi_demo waits while another connection
+ * holds a write lock, then commits each result exactly once, without reusing
+ * or skipping IDs from table \c sequence */
+//! \cond
+BOOST_AUTO_TEST_CASE(busy_retry)
+{
+    using namespace std::chrono_literals;
+    // Longer than all waits of the default busy handler, hence sqlite::busy_error
+    // is thrown and the transaction is executed again
+    constexpr auto hold = 1s;
+    constexpr int64_t total = 10;
+    sofi_demo_init();
+    sqlite::connection db{std::string{db_file}, false};
+    db.busy_timeout(10s);
+    auto exec = [&db](const std::string& sql) {
+        BOOST_TEST_INFO_SCOPE("sql: " << sql);
+        sqlite::query q{db, sql};
+        BOOST_TEST_REQUIRE(q.start().next_row() == sqlite::query::status::done);
+    };
+    auto value = [&db](const std::string& sql) {
+        BOOST_TEST_INFO_SCOPE("sql: " << sql);
+        sqlite::query q{db, sql};
+        BOOST_TEST_REQUIRE(q.start().next_row() == sqlite::query::status::row);
+        return q.get<int64_t>(0);
+    };
+    for (auto&& sql: query::var().sql)
+        exec(sql);
+    exec(query::entity("subject"));
+    exec(query::entity("object"));
+    // Each request allocates a new integrity ID
+    exec(R"(insert into request_ins
+        with recursive n(i) as (select 1 union all select i + 1 from n where i < )"s + std::to_string(total) + R"()
+        select 'subject', 'object', 'set_integrity', '["i' || i || '"]', i from n)");
+    exec(R"(begin immediate transaction)");
+    int status = -1;
+    std::chrono::steady_clock::time_point finished{};
+    std::thread runner{[&status, &finished]() {
+        status = sofi_demo_status("run");
+        finished = std::chrono::steady_clock::now();
+    }};
+    std::this_thread::sleep_for(hold);
+    BOOST_TEST(value(R"(select count() from result)") == 0);
+    auto released = std::chrono::steady_clock::now();
+    exec(R"(commit transaction)");
+    runner.join();
+    BOOST_TEST(status == 0);
+    // The program has not given up while the lock was held
+    BOOST_TEST((finished > released));
+    BOOST_TEST(value(R"(select count() from request)") == 0);
+    BOOST_TEST(value(R"(select count() from result where allowed and not error)") == total);
+    BOOST_TEST(value(R"(select count(distinct id) == count() and min(id) == 0 and max(id) == )"s +
+                     std::to_string(total - 1) + R"( from result)") == 1);
+    BOOST_TEST(value(R"(select next from sequence where name == 'request')") == total);
+    BOOST_TEST(value(R"(select count() from integrity_hash where content like '["i%"]')") == total);
+    BOOST_TEST(value(R"(select count() from integrity_id
+        where id >= (select next from sequence where name == 'integrity_id'))") == 0);
+    BOOST_TEST(value(R"(select count(distinct id) == count() from integrity_id)") == 1);
+}
+//! \endcond
+
+/*! \file
+ * \test \c transaction_commit_failed -- A transaction remains active after its
+ * commit fails, and it is rolled back by the destructor */
+//! \cond
+BOOST_AUTO_TEST_CASE(transaction_commit_failed)
+{
+    sofi_demo_init();
+    sqlite::connection db{std::string{db_file}, false};
+    auto exec = [&db](const std::string& sql) {
+        BOOST_TEST_INFO_SCOPE("sql: " << sql);
+        sqlite::query q{db, sql};
+        BOOST_TEST_REQUIRE(q.start().next_row() == sqlite::query::status::done);
+    };
+    auto value = [&db](const std::string& sql) {
+        BOOST_TEST_INFO_SCOPE("sql: " << sql);
+        sqlite::query q{db, sql};
+        BOOST_TEST_REQUIRE(q.start().next_row() == sqlite::query::status::row);
+        return q.get<int64_t>(0);
+    };
+    exec(R"(pragma foreign_keys = 1)");
+    exec(R"(create temp table parent (id integer primary key))");
+    exec(R"(create temp table child (id integer references parent(id) deferrable initially deferred))");
+    {
+        sqlite::transaction tr{db};
+        exec(R"(insert into child values (1))");
+        // A deferred foreign key constraint is checked by the commit
+        BOOST_CHECK_THROW(tr.commit(), sqlite::error);
+        BOOST_TEST(value(R"(select count() from child)") == 1);
+    }
+    BOOST_TEST(value(R"(select count() from child)") == 0);
+    {
+        sqlite::transaction tr{db};
+        exec(R"(insert into parent values (1))");
+        exec(R"(insert into child values (1))");
+        tr.commit();
+    }
+    BOOST_TEST(value(R"(select count() from child)") == 1);
+}
+//! \endcond
+
+/*! \file
+ * \test \c import_same -- The subject and the object imported together are the same entity */
+//! \cond
+BOOST_AUTO_TEST_CASE(import_same)
+{
+    sofi_test{
+        .sql_prepare = {
+            query::var(),
+            { "entities", {
+                query::entity("subject", "'[subj_data]'"),
+                query::entity("other", "'[other_data]'", "integrity_empty", "acl_deny"),
+            }},
+            { "requests", {
+                R"(insert into request_ins values ('subject', 'subject', 'set_integrity', '["i1"]', ''))",
+            }},
+        },
+        .sql_check = {
+            { "result", {
+                R"(select count() == 1 from result where allowed and not error)",
+            }},
+            { "entity", {
+                R"(select count() == 2 from entity)",
+                R"(select data == '[subj_data]' from entity where name == 'subject')",
+                R"(select elems == '["i1"]'
+                    from entity join integrity_json on entity.integrity == integrity_json.id where name=='subject')",
+                R"(select data == '[other_data]' from entity where name == 'other')",
+            }},
+        },
+    }.run();
+}
+//! \endcond
+
+/*! \file
+ * \test \c pool -- Reader connections of a connection pool are query-only and
+ * see a consistent snapshot while the writer commits */
+//! \cond
+BOOST_AUTO_TEST_CASE(pool)
+{
+    sofi_demo_init();
+    sqlite::pool p{std::string{db_file}};
+    auto value = [](sqlite::connection& db, const std::string& sql) {
+        BOOST_TEST_INFO_SCOPE("sql: " << sql);
+        sqlite::query q{db, sql};
+        BOOST_TEST_REQUIRE(q.start().next_row() == sqlite::query::status::row);
+        return q.get<int64_t>(0);
+    };
+    const std::string count = R"(select count() from request_ins)";
+    const std::string insert = R"(insert into request_ins values ('subject', 'object', 'no_op', null, ''))";
+    BOOST_TEST(value(p.writer(), R"(select journal_mode == 'wal' from pragma_journal_mode)") == 1);
+    BOOST_TEST(value(p.writer(), R"(pragma query_only)") == 0);
+    BOOST_TEST(value(p.reader(), R"(pragma query_only)") == 1);
+    BOOST_CHECK_THROW(sqlite::query(p.reader(), insert).start().next_row(), sqlite::error);
+    BOOST_TEST(value(p.reader(), count) == 0);
+    {
+        sqlite::transaction tr{p.reader()};
+        BOOST_TEST(value(p.reader(), count) == 0);
+        sqlite::query(p.writer(), insert).start().next_row();
+        BOOST_TEST(value(p.writer(), count) == 1);
+        // The reader keeps its snapshot until the end of its transaction
+        BOOST_TEST(value(p.reader(), count) == 0);
+        tr.commit();
+    }
+    BOOST_TEST(value(p.reader(), count) == 1);
+}
+//! \endcond
+
+/*! \file
+ * \test \c presets -- Commands accept named connection option presets */
+//! \cond
+BOOST_AUTO_TEST_CASE(presets)
+{
+    sofi_test{
+        .sql_prepare = {
+            query::var(),
+            { "entities", {
+                query::entity("subject", "'[subj_data]'"),
+            }},
+            { "requests", {
+                R"(insert into request_ins values ('subject', 'subject', 'set_integrity', '["i1"]', ''))",
+            }},
+        },
+        .sql_check = {
+            { "result", {
+                R"(select count() == 1 from result where allowed and not error)",
+            }},
+            { "entity", {
+                R"(select elems == '["i1"]'
+                    from entity join integrity_json on entity.integrity == integrity_json.id where name=='subject')",
+            }},
+        },
+        .commands = {"-p oltp run", "-p oltp gc"},
+    }.run();
+}
+//! \endcond
+
+/*! \file
+ * \test \c bulk_load -- Requests are processed with preset \c bulk_load
+ * (exclusive locking), sequentially and with parallel jobs requested. No other
+ * connection may be open while \c sofi_demo runs. */
+//! \cond
+BOOST_AUTO_TEST_CASE(bulk_load)
+{
+    for (auto&& cmd: {"-p bulk_load run", "-p bulk_load -j 4 run"}) {
+        BOOST_TEST_INFO_SCOPE("command: " << cmd);
+        sofi_demo_init();
+        {
+            sqlite::connection db{std::string{db_file}, false};
+            for (auto&& sql: query::var().sql)
+                sqlite::query(db, sql).start().next_row();
+            sqlite::query(db, query::entity("subject")).start().next_row();
+            sqlite::query(db, R"(insert into request_ins values
+                ('subject', 'subject', 'append_arg', 'a', ''),
+                ('subject', 'subject', 'append_arg', 'b', ''),
+                ('subject', 'subject', 'set_integrity', '["i1"]', ''),
+                ('subject', 'subject', 'append_arg', 'c', ''))").start().next_row();
+        }
+        sofi_demo_run(cmd);
+        sqlite::connection db{std::string{db_file}, false};
+        query::check(db, {
+            R"(select count() == 4 from result where allowed and not error)",
+            R"(select count() == 0 from request)",
+            R"(select data == 'abc' from entity where name == 'subject')",
+            R"(select elems == '["i1"]'
+                from entity join integrity_json on entity.integrity == integrity_json.id where name == 'subject')",
+        });
+    }
+}
+//! \endcond
+
+/*! \file
+ * \test \c policy_blob -- Entities are exported with policy blobs and imported from them */
+//! \cond
+BOOST_AUTO_TEST_CASE(policy_blob)
+{
+    sofi_test{
+        .sql_prepare = {
+            query::var(),
+            { "entities", {
+                query::entity("subject", "'[subj_data]'"),
+                query::entity("object", "'[obj_data]'"),
+                query::entity("other", "'[other_data]'"),
+                // An invalid policy, cleared by changing the integrity
+                R"(insert into entity_policy values ('other', x'00'))",
+                R"(update entity set integrity = )"s + query::var("integrity_empty") + R"( where name == 'other')",
+            }},
+            { "requests", {
+                R"(insert into request_ins values ('subject', 'object', 'set_integrity', '["i1"]', ''))",
+                R"(insert into request_ins values ('subject', 'object', 'write', null, ''))",
+                R"(insert into request_ins values ('subject', 'object', 'set_integrity', '["i2"]', ''))",
+                R"(insert into request_ins values ('subject', 'other', 'no_op', null, ''))",
+            }},
+        },
+        .sql_check = {
+            { "result", {
+                R"(select count() == 4 from result where allowed and not error)",
+            }},
+            { "entity", {
+                R"(select count() == 3 from entity_policy)",
+                R"(select data == '[subj_data]' from entity_json where name == 'object')",
+                R"(select integrity == '["i2"]' from entity_json where name == 'object')",
+                R"(select integrity == '"universe"' from entity_json where name == 'subject')",
+                R"(select integrity == '[]' from entity_json where name == 'other')",
+            }},
+        },
+    }.run();
+}
+//! \endcond
+
+/*! \file
+ * \test \c policy_invalidation -- Policy blobs are deleted if the normalized
+ * rows they were encoded from are changed */
+//! \cond
+BOOST_AUTO_TEST_CASE(policy_invalidation)
+{
+    sofi_test{
+        .sql_prepare = {
+            query::var(),
+            { "entities", {
+                query::entity("subject", "'[subj_data]'"),
+                query::entity("object", "'[obj_data]'"),
+            }},
+            { "requests", {
+                R"(insert into request_ins values ('subject', 'object', 'set_integrity', '["i1"]', ''))",
+            }},
+        },
+        .sql_check = {
+            { "entity_policy", {
+                R"(select count() == 2 from entity_policy)",
+            }},
+        },
+    }.run();
+    sqlite::connection db{std::string{db_file}, false};
+    auto exec = [&db](const std::string& sql) {
+        BOOST_TEST_INFO_SCOPE("sql: " << sql);
+        sqlite::query q{db, sql};
+        BOOST_TEST_REQUIRE(q.start().next_row() == sqlite::query::status::done);
+    };
+    auto policies = [&db]() {
+        sqlite::query q{db, R"(select coalesce(group_concat(name, ','), '') from
+                                (select name from entity_policy order by name))"};
+        BOOST_TEST_REQUIRE(q.start().next_row() == sqlite::query::status::row);
+        return q.get<std::string>(0);
+    };
+    auto export_again = [&exec]() {
+        exec(R"(insert into request_ins values ('subject', 'object', 'no_op', null, ''))");
+        sofi_demo_run("run");
+    };
+    BOOST_TEST(policies() == "object,subject");
+    // Integrity elements
+    exec(R"(update integrity set elem = 'i3' where id == (select integrity from entity where name == 'object'))");
+    BOOST_TEST(policies() == "subject");
+    // Integrity functions
+    exec(R"(update int_fun_id set comment = comment
+            where id == (select prov_fun from entity where name == 'subject'))");
+    BOOST_TEST(policies() == "");
+    export_again();
+    BOOST_TEST(policies() == "object,subject");
+    // ACLs
+    exec(R"(update acl set op = op where id == (select acl from entity where name == 'subject'))");
+    BOOST_TEST(policies() == "");
+    export_again();
+    BOOST_TEST(policies() == "object,subject");
+    // Integrities referenced by ACLs
+    exec(R"(insert into integrity select a.integrity, 'i4' from acl as a
+            where a.id == (select min_integrity from entity where name == 'object'))");
+    BOOST_TEST(policies() == "");
+    query::check(db, {R"(select integrity == '["i3"]' from entity_json where name == 'object')"});
+}
+//! \endcond
+
+/*! \file
+ * \test \c gc -- Command `sofi_demo gc` deletes unreferenced exported values */
+//! \cond
+BOOST_AUTO_TEST_CASE(gc)
+{
+    sofi_test{
+        .sql_prepare = {
+            query::var(),
+            { "entities", {
+                query::entity("subject", "'[subj_data]'"),
+                query::entity("object", "'[obj_data]'"),
+            }},
+            { "requests", {
+                R"(insert into request_ins values ('subject', 'object', 'set_integrity', '["i1"]', ''))",
+                R"(insert into request_ins values ('subject', 'object', 'set_integrity', '["i2"]', ''))",
+                R"(insert into request_ins values ('subject', 'object', 'set_min_integrity', '[["m"]]', ''))",
+                R"(insert into request_ins values ('subject', 'object', 'destroy', '', ''))",
+            }},
+        },
+        .sql_check = {
+            { "entities", {
+                R"(select count() == 1 from entity)",
+                R"(select elems == '"universe"'
+                    from entity join integrity_json on entity.integrity == integrity_json.id where name=='subject')",
+            }},
+            { "hash", {
+                R"(select count() == 0 from integrity_hash where content in ('["i1"]', '["i2"]', '["m"]'))",
+                R"(select count() == 2 from integrity_hash)",
+                R"(select count() == 1 from acl_hash)",
+                R"(select count() == 3 from int_fun_hash)",
+            }},
+            { "seeds", {
+                R"(select count() == 1 from integrity_id where id == )" + query::var("integrity_empty"),
+                R"(select count() == 1 from integrity_id where id == )" + query::var("integrity_universe"),
+                R"(select count() == 1 from acl_id where id == )" + query::var("acl_allow"),
+                R"(select count() == 1 from acl_id where id == )" + query::var("acl_deny"),
+                R"(select count() == 1 from int_fun_id where id == )" + query::var("fun_min"),
+                R"(select count() == 1 from int_fun_id where id == )" + query::var("fun_identity"),
+                R"(select count() == 1 from int_fun_id where id == )" + query::var("fun_max"),
+            }},
+        },
+        .commands = {"run", "gc"},
+    }.run();
+}
+//! \endcond
+
 namespace {
 
 struct test_op_acl {